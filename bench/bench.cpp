@@ -0,0 +1,520 @@
+/* Microbenchmarks for jrsl.
+ *
+ * Compile with optimizations, from the root of the repository:
+ *
+ *    g++ -O2 -std=c++11 -I. bench/bench.cpp -o jrsl_bench
+ *
+ * Add `-march=native` to let the unrolled skip list scan its blocks with the
+ * widest SIMD instructions of the machine.
+ *
+ * Every workload is run for sizes from 1e3 up to `--max-n` (default 1e6, up to
+ * 1e8 if you have the memory), for several key distributions and values of p,
+ * against the generic skip list, the generic skip list using the slab
+ * allocator, a `JRSL_DEFINE` typed skip list, `JRSL_DEFINE_UNROLLED` skip lists
+ * scanning their blocks one key at a time or with SIMD, a
+ * `JRSL_DEFINE_COMPACT` skip list, the C++ `jrsl::skip_list`, and `std::map` as
+ * a baseline.
+ *
+ * Options:
+ *    --max-n N        largest size (default 1000000)
+ *    --ops N          operations per measurement (default 200000)
+ *    --workload W     only run workload W (insert, search, remove, key_at, mixed)
+ *    --dist D         only use distribution D (uniform, zipf, sequential,
+ *                     reverse)
+ *    --p P            only use probability P (default 0.5, 0.25 and 0.125)
+ *
+ * For each measurement, the mean time per operation, the 50th, 99th and 99.9th
+ * percentiles of sampled operations and the amount of allocations per
+ * operation are printed.
+ */
+
+#define JRSL_IMPLEMENTATION
+#include "jrsl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+JRSL_DEFINE(bench_list, long, JRSL_CMP_NUMBER)
+JRSL_DEFINE_UNROLLED(bench_blocks, long, JRSL_CMP_NUMBER, 16)
+JRSL_DEFINE_UNROLLED_SCAN(bench_simd, jrsl_u64_t, JRSL_CMP_NUMBER, 16,
+                          jrsl_scan_u64)
+JRSL_DEFINE_COMPACT(bench_compact, long, JRSL_CMP_NUMBER)
+
+/* ============================ ALLOCATION COUNTING ========================= */
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  void *ptr = malloc(size);
+  if (!ptr)
+    throw std::bad_alloc();
+  ++allocations;
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+static void *counting_alloc(void *context, size_t size, unsigned short level) {
+  (void)context;
+  (void)level;
+  ++allocations;
+  return malloc(size);
+}
+
+static void counting_free(void *context, void *ptr, size_t size,
+                          unsigned short level) {
+  (void)context;
+  (void)size;
+  (void)level;
+  free(ptr);
+}
+
+/* The slab allocator only calls malloc for new chunks */
+static void *counting_slab_alloc(void *context, size_t size,
+                                 unsigned short level) {
+  jrsl_slab_t *slab = (jrsl_slab_t *)context;
+  void *chunks = slab->chunks;
+  void *ptr = jrsl_slab_allocator(slab).alloc(context, size, level);
+  if (slab->chunks != chunks)
+    ++allocations;
+  return ptr;
+}
+
+/* =============================== DISTRIBUTIONS ============================ */
+
+/* xorshift64*, good enough and reproducible */
+struct rng_t {
+  unsigned long long state;
+  explicit rng_t(unsigned long long seed) : state(seed ? seed : 1) {}
+  unsigned long long next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+  }
+  double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+/* Zipfian generator from Gray et al., "Quickly generating billion-record
+ * synthetic databases" (also used by YCSB). */
+struct zipf_t {
+  size_t n;
+  double theta, alpha, zetan, eta;
+  zipf_t(size_t n, double theta) : n(n), theta(theta) {
+    double zeta2 = 1 + std::pow(0.5, theta);
+    zetan = 0;
+    for (size_t i = 1; i <= n; ++i)
+      zetan += 1 / std::pow((double)i, theta);
+    alpha = 1 / (1 - theta);
+    eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+  }
+  size_t next(rng_t &rng) {
+    double u = rng.uniform();
+    double uz = u * zetan;
+    if (uz < 1)
+      return 0;
+    if (uz < 1 + std::pow(0.5, theta))
+      return 1;
+    size_t r = (size_t)(n * std::pow(eta * u - eta + 1, alpha));
+    return r < n ? r : n - 1;
+  }
+};
+
+enum dist_t { UNIFORM, ZIPF, SEQUENTIAL, REVERSE };
+static const char *dist_names[] = {"uniform", "zipf", "sequential", "reverse"};
+
+/* Generates `count` keys in [0, n) */
+static std::vector<long> make_keys(dist_t dist, size_t n, size_t count,
+                                   unsigned long long seed) {
+  std::vector<long> keys(count);
+  rng_t rng(seed);
+  size_t i;
+
+  switch (dist) {
+  case UNIFORM:
+    for (i = 0; i < count; ++i)
+      keys[i] = (long)(rng.next() % n);
+    break;
+  case ZIPF: {
+    zipf_t zipf(n, 0.99);
+    /* Scatters the popular keys over the whole key space */
+    for (i = 0; i < count; ++i)
+      keys[i] = (long)((zipf.next(rng) * 2654435761ULL) % n);
+    break;
+  }
+  case SEQUENTIAL:
+    for (i = 0; i < count; ++i)
+      keys[i] = (long)(i % n);
+    break;
+  case REVERSE:
+    for (i = 0; i < count; ++i)
+      keys[i] = (long)(n - 1 - i % n);
+    break;
+  }
+  return keys;
+}
+
+/* ================================ STRUCTURES ============================== */
+
+static char compare_long(void *key1, void *key2) {
+  long a = *(long *)key1, b = *(long *)key2;
+  return (a > b) - (a < b);
+}
+
+/* All structures map a long key to a pointer. The generic skip list stores
+ * pointers to keys, which live in `boxes`. */
+struct structure_t {
+  virtual ~structure_t() {}
+  virtual void insert(long key) = 0;
+  virtual void *search(long key) = 0;
+  virtual void remove(long key) = 0;
+  virtual long key_at(size_t index) = 0;
+};
+
+static std::vector<long> boxes;
+
+struct generic_t : structure_t {
+  skip_list_t list;
+  jrsl_slab_t slab;
+  bool use_slab;
+
+  generic_t(float p, size_t n, bool use_slab) : use_slab(use_slab) {
+    jrsl_allocator_t allocator;
+    jrsl_initialize(&list, compare_long, NULL, p, jrsl_max_level(n, p) + 1);
+    if (use_slab) {
+      jrsl_slab_init(&slab, 1024);
+      allocator = jrsl_slab_allocator(&slab);
+      allocator.alloc = counting_slab_alloc;
+    } else {
+      allocator.alloc = counting_alloc;
+      allocator.free = counting_free;
+      allocator.release = NULL;
+      allocator.context = NULL;
+    }
+    jrsl_set_allocator(&list, &allocator);
+  }
+  ~generic_t() { jrsl_destroy(&list, NULL); }
+  void insert(long key) { jrsl_insert(&list, &boxes[key], &boxes[key]); }
+  void *search(long key) { return jrsl_search(&list, &key); }
+  void remove(long key) { jrsl_remove(&list, &key); }
+  long key_at(size_t index) { return *(long *)jrsl_key_at(&list, index); }
+};
+
+struct typed_t : structure_t {
+  bench_list_t list;
+
+  typed_t(float p, size_t n) {
+    jrsl_allocator_t allocator;
+    bench_list_initialize(&list, p, jrsl_max_level(n, p) + 1);
+    allocator.alloc = counting_alloc;
+    allocator.free = counting_free;
+    allocator.release = NULL;
+    allocator.context = NULL;
+    bench_list_set_allocator(&list, &allocator);
+  }
+  ~typed_t() { bench_list_destroy(&list, NULL); }
+  void insert(long key) { bench_list_insert(&list, key, &boxes[key]); }
+  void *search(long key) { return bench_list_search(&list, key); }
+  void remove(long key) { bench_list_remove(&list, key); }
+  long key_at(size_t index) { return *bench_list_key_at(&list, index); }
+};
+
+struct unrolled_t : structure_t {
+  bench_blocks_t list;
+
+  unrolled_t(float p, size_t n) {
+    jrsl_allocator_t allocator;
+    /* The levels index blocks of 8 to 16 keys */
+    bench_blocks_initialize(&list, p, jrsl_max_level(n / 8 + 1, p) + 1);
+    allocator.alloc = counting_alloc;
+    allocator.free = counting_free;
+    allocator.release = NULL;
+    allocator.context = NULL;
+    bench_blocks_set_allocator(&list, &allocator);
+  }
+  ~unrolled_t() { bench_blocks_destroy(&list, NULL); }
+  void insert(long key) { bench_blocks_insert(&list, key, &boxes[key]); }
+  void *search(long key) { return bench_blocks_search(&list, key); }
+  void remove(long key) { bench_blocks_remove(&list, key); }
+  long key_at(size_t index) { return *bench_blocks_key_at(&list, index); }
+};
+
+/* The keys are never negative, so they keep their order as unsigned */
+struct unrolled_simd_t : structure_t {
+  bench_simd_t list;
+
+  unrolled_simd_t(float p, size_t n) {
+    jrsl_allocator_t allocator;
+    bench_simd_initialize(&list, p, jrsl_max_level(n / 8 + 1, p) + 1);
+    allocator.alloc = counting_alloc;
+    allocator.free = counting_free;
+    allocator.release = NULL;
+    allocator.context = NULL;
+    bench_simd_set_allocator(&list, &allocator);
+  }
+  ~unrolled_simd_t() { bench_simd_destroy(&list, NULL); }
+  void insert(long key) {
+    bench_simd_insert(&list, (jrsl_u64_t)key, &boxes[key]);
+  }
+  void *search(long key) { return bench_simd_search(&list, (jrsl_u64_t)key); }
+  void remove(long key) { bench_simd_remove(&list, (jrsl_u64_t)key); }
+  long key_at(size_t index) { return (long)*bench_simd_key_at(&list, index); }
+};
+
+/* The pool grows with realloc, which is not counted */
+struct compact_t : structure_t {
+  bench_compact_t list;
+
+  compact_t(float p, size_t n) {
+    bench_compact_initialize(&list, p, jrsl_max_level(n, p) + 1);
+  }
+  ~compact_t() { bench_compact_destroy(&list, NULL); }
+  void insert(long key) { bench_compact_insert(&list, key, &boxes[key]); }
+  void *search(long key) { return bench_compact_search(&list, key); }
+  void remove(long key) { bench_compact_remove(&list, key); }
+  long key_at(size_t index) { return *bench_compact_key_at(&list, index); }
+};
+
+struct cxx_t : structure_t {
+  jrsl::skip_list<long, void *> list;
+
+  cxx_t(float p) : list(p) {}
+  void insert(long key) { list.insert_or_assign(key, &boxes[key]); }
+  void *search(long key) {
+    jrsl::skip_list<long, void *>::iterator it = list.find(key);
+    return it == list.end() ? NULL : it->second;
+  }
+  void remove(long key) { list.erase(key); }
+  long key_at(size_t index) { return list[index].first; }
+};
+
+struct map_t : structure_t {
+  std::map<long, void *> map;
+
+  void insert(long key) { map[key] = &boxes[key]; }
+  void *search(long key) {
+    std::map<long, void *>::iterator it = map.find(key);
+    return it == map.end() ? NULL : it->second;
+  }
+  void remove(long key) { map.erase(key); }
+  /* std::map has no random access, this walks the tree */
+  long key_at(size_t index) {
+    std::map<long, void *>::iterator it = map.begin();
+    std::advance(it, index);
+    return it->first;
+  }
+};
+
+enum kind_t {
+  GENERIC,
+  SLAB,
+  TYPED,
+  UNROLLED,
+  UNROLLED_SIMD,
+  COMPACT,
+  CXX,
+  MAP
+};
+static const char *kind_names[] = {"jrsl",          "jrsl+slab",
+                                   "jrsl_typed",    "jrsl_unrolled",
+                                   "unrolled+simd", "jrsl_compact",
+                                   "jrsl_cxx",      "std::map"};
+
+static structure_t *make_structure(kind_t kind, float p, size_t n) {
+  switch (kind) {
+  case GENERIC:
+    return new generic_t(p, n, false);
+  case SLAB:
+    return new generic_t(p, n, true);
+  case TYPED:
+    return new typed_t(p, n);
+  case UNROLLED:
+    return new unrolled_t(p, n);
+  case UNROLLED_SIMD:
+    return new unrolled_simd_t(p, n);
+  case COMPACT:
+    return new compact_t(p, n);
+  case CXX:
+    return new cxx_t(p);
+  default:
+    return new map_t();
+  }
+}
+
+/* ================================= WORKLOADS ============================== */
+
+enum workload_t { INSERT, SEARCH, REMOVE, KEY_AT, MIXED };
+static const char *workload_names[] = {"insert", "search", "remove", "key_at",
+                                       "mixed"};
+
+typedef std::chrono::steady_clock clock_type;
+
+static double elapsed_ns(clock_type::time_point start) {
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             clock_type::now() - start)
+      .count();
+}
+
+/* Only one operation out of `SAMPLE_RATE` is timed on its own, to keep the
+ * timer out of the mean. */
+#define SAMPLE_RATE 32
+
+struct result_t {
+  double mean, p50, p99, p999, allocs;
+};
+
+static volatile size_t sink;
+
+static void run_op(structure_t *s, workload_t workload, long key,
+                   size_t index, unsigned long long r) {
+  switch (workload) {
+  case INSERT:
+    s->insert(key);
+    break;
+  case SEARCH:
+    sink += s->search(key) != NULL;
+    break;
+  case REMOVE:
+    s->remove(key);
+    break;
+  case KEY_AT:
+    sink += s->key_at(index);
+    break;
+  case MIXED:
+    /* 50% searches, 25% inserts, 25% removes */
+    if (r % 4 < 2)
+      sink += s->search(key) != NULL;
+    else if (r % 4 == 2)
+      s->insert(key);
+    else
+      s->remove(key);
+    break;
+  }
+}
+
+static result_t run(kind_t kind, workload_t workload, dist_t dist, float p,
+                    size_t n, size_t ops) {
+  structure_t *s = make_structure(kind, p, n);
+  std::vector<long> keys;
+  std::vector<double> samples;
+  size_t i, count;
+  rng_t rng(42);
+  result_t result;
+
+  /* Every workload but insert starts from a full list, filled in a random
+   * order. */
+  if (workload != INSERT) {
+    std::vector<long> fill(n);
+    for (i = 0; i < n; ++i)
+      fill[i] = (long)i;
+    for (i = n; i > 1; --i)
+      std::swap(fill[i - 1], fill[rng.next() % i]);
+    for (i = 0; i < n; ++i)
+      s->insert(fill[i]);
+  }
+
+  /* Inserting or removing more than n distinct keys is meaningless */
+  count = workload == INSERT || workload == REMOVE ? std::min(ops, n) : ops;
+  keys = make_keys(dist, n, count, 7);
+  /* key_at is linear for std::map, keeps it from taking forever */
+  if (workload == KEY_AT && kind == MAP)
+    count = std::min(count, std::max((size_t)SAMPLE_RATE, 20000000 / n));
+  samples.reserve(count / SAMPLE_RATE + 1);
+
+  allocations = 0;
+  clock_type::time_point start = clock_type::now();
+  for (i = 0; i < count; ++i) {
+    unsigned long long r = rng.next();
+    if (i % SAMPLE_RATE == 0) {
+      clock_type::time_point op_start = clock_type::now();
+      run_op(s, workload, keys[i], (size_t)keys[i], r);
+      samples.push_back(elapsed_ns(op_start));
+    } else {
+      run_op(s, workload, keys[i], (size_t)keys[i], r);
+    }
+  }
+  result.mean = elapsed_ns(start) / count;
+  result.allocs = (double)allocations / count;
+
+  std::sort(samples.begin(), samples.end());
+  result.p50 = samples[samples.size() / 2];
+  result.p99 = samples[samples.size() * 99 / 100];
+  result.p999 = samples[samples.size() * 999 / 1000];
+
+  delete s;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  size_t max_n = 1000000, ops = 200000, n;
+  std::string only_workload, only_dist;
+  std::vector<float> ps;
+  int i, w, d, k;
+  size_t pi;
+
+  for (i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--max-n"))
+      max_n = (size_t)atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "--ops"))
+      ops = (size_t)atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "--workload"))
+      only_workload = argv[i + 1];
+    else if (!strcmp(argv[i], "--dist"))
+      only_dist = argv[i + 1];
+    else if (!strcmp(argv[i], "--p"))
+      ps.push_back((float)atof(argv[i + 1]));
+    else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (ps.empty()) {
+    ps.push_back(0.5f);
+    ps.push_back(0.25f);
+    ps.push_back(0.125f);
+  }
+
+  boxes.resize(max_n);
+  for (n = 0; n < max_n; ++n)
+    boxes[n] = (long)n;
+
+  printf("%-8s %-10s %-6s %-10s %-13s %10s %10s %10s %10s %10s\n", "workload",
+         "dist", "p", "n", "structure", "ns/op", "p50", "p99", "p99.9",
+         "allocs/op");
+
+  for (w = INSERT; w <= MIXED; ++w) {
+    if (!only_workload.empty() && only_workload != workload_names[w])
+      continue;
+    for (d = UNIFORM; d <= REVERSE; ++d) {
+      if (!only_dist.empty() && only_dist != dist_names[d])
+        continue;
+      for (n = 1000; n <= max_n; n *= 10) {
+        for (k = GENERIC; k <= MAP; ++k) {
+          for (pi = 0; pi < ps.size(); ++pi) {
+            result_t r;
+            /* p means nothing to std::map */
+            if (k == MAP && pi > 0)
+              break;
+            r = run((kind_t)k, (workload_t)w, (dist_t)d, ps[pi], n, ops);
+            printf("%-8s %-10s %-6.3g %-10lu %-13s %10.1f %10.0f %10.0f "
+                   "%10.0f %10.2f\n",
+                   workload_names[w], dist_names[d],
+                   k == MAP ? 0.0 : ps[pi], (unsigned long)n, kind_names[k],
+                   r.mean, r.p50, r.p99, r.p999, r.allocs);
+            fflush(stdout);
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
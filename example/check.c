@@ -0,0 +1,197 @@
+/* Self-checking program for jrsl: applies random updates to skip lists and
+ * checks their invariants against a reference set after every few of them.
+ *
+ *    cc -I. example/check.c -o jrsl_check -lm && ./jrsl_check
+ *
+ * It prints "ok" and returns 0, or describes the first broken invariant and
+ * returns 1. Add `-DJRSL_BACKWARD` to check the backward pointers too. */
+
+#define JRSL_IMPLEMENTATION
+#include "jrsl.h"
+
+/* Number of distinct keys, and of updates per mode */
+#define N 5000
+#define UPDATES 200000
+
+static long keys[N];
+/* The reference set: `in[k]` is 1 when key `k` is in the list */
+static char in[N];
+static size_t count;
+
+static char compare_long(void *key1, void *key2) {
+  long a = *(long *)key1, b = *(long *)key2;
+  return (a > b) - (a < b);
+}
+
+static void fail(const char *mode, unsigned long update, const char *what) {
+  printf("%s mode, after %lu updates: %s\n", mode, update, what);
+  exit(EXIT_FAILURE);
+}
+
+/* Checks the order of the keys against the reference set, then that every
+ * link of every level leads to the next node of that level and that its width
+ * is the difference of their ranks (0 for a link to NULL). */
+static const char *check_links(skip_list_t *list) {
+  size_t i, rank;
+  long k = -1;
+  skip_node_t *x, *last = NULL;
+
+  for (x = list->head->forward[0].node; x; x = x->forward[0].node) {
+#ifdef JRSL_BACKWARD
+    if (x->backward != (k < 0 ? NULL : last))
+      return "wrong backward pointer";
+    last = x;
+#endif
+    while (++k < *(long *)x->key)
+      if (in[k])
+        return "missing key";
+    if (!in[k])
+      return "unexpected key";
+  }
+  while (++k < N)
+    if (in[k])
+      return "missing key";
+  if (list->width != count)
+    return "wrong width";
+
+  for (i = 0; i < list->level; ++i) {
+    size_t last_rank = 0;
+    last = list->head;
+    rank = 0;
+    for (x = list->head->forward[0].node; x; x = x->forward[0].node) {
+      ++rank;
+      if (x->level <= i)
+        continue;
+      if (last->forward[i].node != x)
+        return "link skipping a node of its level";
+      if (last->forward[i].width != rank - last_rank)
+        return "wrong link width";
+      last = x;
+      last_rank = rank;
+    }
+    if (last->forward[i].node || last->forward[i].width)
+      return "last link of a level not to NULL with width 0";
+  }
+  if (list->level > 1 && !list->head->forward[list->level - 1].node)
+    return "empty top level";
+  return NULL;
+}
+
+/* Checks the 1-2-3 rule of deterministic lists: between two consecutive
+ * nodes of a level, or after the last one, the level below has 1 to 3
+ * nodes. */
+static const char *check_gaps(skip_list_t *list) {
+  size_t i;
+  if (!list->width)
+    return NULL;
+  for (i = 0; i < list->level; ++i) {
+    skip_node_t *x = list->head;
+    while (x) {
+      skip_node_t *end = i + 1 < list->level ? x->forward[i + 1].node : NULL;
+      skip_node_t *y = x->forward[i].node;
+      size_t gap = 0;
+      while (y != end) {
+        ++gap;
+        y = y->forward[i].node;
+      }
+      if (gap < 1 || gap > 3)
+        return "gap breaking the 1-2-3 rule";
+      x = end;
+    }
+  }
+  return NULL;
+}
+
+/* Checks the searches, ranks and random access of a few keys. */
+static const char *check_queries(skip_list_t *list, unsigned long seed) {
+  size_t i;
+  for (i = 0; i < 64; ++i) {
+    size_t k = (seed + i * 7919) % N;
+    long *data = (long *)jrsl_search(list, &keys[k]);
+    if ((data != NULL) != in[k] || (data && *data != (long)k))
+      return "wrong search result";
+    if (in[k] && jrsl_key_at(list, jrsl_rank(list, &keys[k])) != &keys[k])
+      return "key_at and rank disagree";
+  }
+  if (jrsl_key_at(list, list->width) != NULL)
+    return "key_at past the end";
+  return NULL;
+}
+
+static void run(const char *mode, int deterministic) {
+  skip_list_t list;
+  unsigned long update, state = 12345;
+  const char *error;
+  size_t k;
+
+  memset(in, 0, sizeof(in));
+  count = 0;
+  jrsl_initialize(&list, compare_long, NULL, 0.5f, 4);
+  jrsl_seed(&list, 42);
+  if (deterministic)
+    jrsl_set_deterministic(&list);
+
+  for (update = 1; update <= UPDATES; ++update) {
+    state = (state * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+    k = (size_t)(state >> 4) % N;
+
+    switch ((state >> 1) % 8) {
+    case 0:
+    case 1:
+    case 2:
+      if ((jrsl_insert(&list, &keys[k], &keys[k]) != NULL) != in[k])
+        fail(mode, update, "insert disagrees with the reference");
+      count += !in[k];
+      in[k] = 1;
+      break;
+    case 3:
+    case 4:
+      if ((jrsl_remove(&list, &keys[k]) != NULL) != in[k])
+        fail(mode, update, "remove disagrees with the reference");
+      count -= in[k];
+      in[k] = 0;
+      break;
+    case 5:
+      if (list.width) {
+        size_t index = k % list.width;
+        long key = *(long *)jrsl_key_at(&list, index);
+        if (jrsl_remove_at(&list, index) != &keys[key])
+          fail(mode, update, "remove_at removed the wrong element");
+        in[key] = 0;
+        --count;
+      }
+      break;
+    default:
+      /* Bulk updates choose their own levels, which the 1-2-3 rule does not
+       * hold for */
+      if (!deterministic && update % 64 == 0) {
+        size_t lo = k % (list.width + 1), i;
+        size_t hi = lo + (state >> 8) % 16;
+        for (i = lo; i < hi && i < list.width; ++i)
+          in[*(long *)jrsl_key_at(&list, i)] = 0;
+        count -= jrsl_remove_range(&list, lo, hi, NULL);
+      }
+      break;
+    }
+
+    if (update % 251 == 0 || update == UPDATES) {
+      if ((error = check_links(&list)) ||
+          (deterministic && (error = check_gaps(&list))) ||
+          (error = check_queries(&list, state)))
+        fail(mode, update, error);
+    }
+  }
+
+  jrsl_destroy(&list, NULL);
+}
+
+int main() {
+  size_t i;
+  for (i = 0; i < N; ++i)
+    keys[i] = (long)i;
+
+  run("random", 0);
+  run("deterministic", 1);
+  printf("ok\n");
+  return 0;
+}
@@ -52,10 +52,152 @@
 
 #include <assert.h> /* for assert() */
 #include <math.h>   /* for log() */
+#include <stddef.h> /* for offsetof() */
 #include <stdio.h>  /* for printf() and sprintf()*/
-#include <stdlib.h> /* for malloc() and rand()*/
+#include <stdlib.h> /* for malloc() */
 #include <string.h> /* for strlen() */
 
+/* Vector instructions used by the block scans of unrolled skip lists, when the
+ * compiler targets them. Define `JRSL_NO_SIMD` to always scan one key at a
+ * time. */
+#if !defined(JRSL_NO_SIMD)
+#if defined(__AVX2__)
+#define JRSL_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define JRSL_SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__SSE4_2__)
+#define JRSL_SIMD_SSE42
+#include <nmmintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define JRSL_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/* Asks the CPU to start loading the cache line of `addr`, which is never
+ * dereferenced and may be NULL. */
+#if defined(__GNUC__)
+#define JRSL_PREFETCH_HINT(addr) __builtin_prefetch(addr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define JRSL_PREFETCH_HINT(addr) _mm_prefetch((const char *)(addr), _MM_HINT_T0)
+#else
+#define JRSL_PREFETCH_HINT(addr) ((void)0)
+#endif
+
+/* Defining `JRSL_ENABLE_PREFETCH` makes the descents of `jrsl_search`,
+ * `jrsl_insert` and `jrsl_node_at` prefetch the node after the next one while
+ * the next key is compared. It helps lists much larger than the caches and
+ * costs a little on small ones. */
+#ifdef JRSL_ENABLE_PREFETCH
+#define JRSL_PREFETCH(addr) JRSL_PREFETCH_HINT(addr)
+#else
+#define JRSL_PREFETCH(addr) ((void)0)
+#endif
+
+/* Upper bound for the `max_level` of any skip list. It sizes the scratch arrays
+ * kept on the stack while updating a list, and can be overridden by defining it
+ * before including this file. */
+#ifndef JRSL_MAX_LEVEL
+#define JRSL_MAX_LEVEL 32
+#endif
+
+/* Defining `JRSL_BACKWARD` gives every node a pointer to the previous node,
+ * which makes `jrsl_prev` and `jrsl_range_reverse` O(1) per step instead of
+ * O(log n), for one more pointer per node. */
+
+/* Defining `JRSL_OPTIMISTIC` lets any number of threads read a skip list while
+ * others update it, without readers taking any lock. Each list has a version
+ * counter which writers make odd while they update it: writers wait for each
+ * other, readers never wait for anything but a writer in progress, and retry
+ * when the version changed under them.
+ *
+ * `jrsl_search`, `jrsl_rank`, `jrsl_key_at` and `jrsl_data_at` are
+ * protected this way, and `jrsl_insert`, `jrsl_insert_batch`, the
+ * `jrsl_remove` family, `jrsl_build_sorted`, the `jrsl_split` family,
+ * `jrsl_concat` and `jrsl_merge` are writers. Other functions (cursors,
+ * bounds, ranges, ...) need the caller to keep writers out.
+ *
+ * Since a reader may still be walking a removed node, `jrsl_remove` keeps it
+ * until `jrsl_reclaim` is called at a time when no reader is running.
+ * This needs the GNU `__atomic` builtins. */
+#if defined(JRSL_OPTIMISTIC) && !defined(__GNUC__)
+#error "JRSL_OPTIMISTIC needs the GNU __atomic builtins"
+#endif
+
+/* Defining `JRSL_THREADS` to a number of threads makes `jrsl_build_sorted`
+ * and `jrsl_merge` split inputs of at least `JRSL_PARALLEL_MIN` elements into
+ * as many ranges, built or merged by POSIX threads and then joined. Only lists
+ * using the default allocator are handled this way, as the other allocators
+ * need not be thread safe. */
+#ifdef JRSL_THREADS
+#include <pthread.h>
+#ifndef JRSL_PARALLEL_MIN
+#define JRSL_PARALLEL_MIN 65536
+#endif
+#endif
+
+/* Defining `JRSL_WAL` lets a skip list append every `jrsl_insert`,
+ * `jrsl_insert_batch` and removal to a `jrsl_log_t`, a buffer written out to a
+ * user stream when it is full or flushed, so that `jrsl_replay` can apply them
+ * again on top of a snapshot. */
+
+/* Defining `JRSL_STATS` makes every skip list count its comparator calls,
+ * descents, forward hops and node allocations, which `jrsl_stats_snapshot`
+ * returns along with the number of nodes of each level. The counters cost an
+ * increment each (an atomic one with `JRSL_OPTIMISTIC`) and are compiled out
+ * otherwise. */
+
+/* Defining `JRSL_AGGREGATE` to a type (for instance `double`) gives every link
+ * the aggregate of the elements it spans, kept up to date alongside its width
+ * once `jrsl_set_aggregator` registered an associative operation over the
+ * elements. `jrsl_prefix_aggregate` and `jrsl_range_aggregate` then return
+ * the aggregate of any range of keys in O(log n), for one more value per link
+ * and a few calls of the operation per level on every update. Both are
+ * readers for `JRSL_OPTIMISTIC`. */
+
+/* Defining `JRSL_SNAPSHOTS` adds `jrsl_snapshot_open`, which returns in O(1)
+ * a point-in-time view of a skip list that stays the same while writers keep
+ * updating it. Every node is stamped with the versions of the list which
+ * inserted and removed it, and a second chain on the lowest level keeps the
+ * removed elements an open snapshot may still see; replacing the data of such
+ * an element copies its node. Nodes leave that chain and are freed once no
+ * snapshot needs them, when snapshots are closed. This costs two versions and
+ * two pointers per node, and a few more stores per update. With
+ * `JRSL_OPTIMISTIC`, snapshots are read without any lock and don't prevent
+ * `jrsl_reclaim`. */
+
+/* Defining `JRSL_MMAP` adds `JRSL_DEFINE_MAPPED`, compact skip lists stored in
+ * a memory mapped file. It needs POSIX `mmap` and `ftruncate`: in a strict ISO
+ * C mode (e.g. `-std=c99`), define `_POSIX_C_SOURCE` to 200112L or more (or
+ * `_XOPEN_SOURCE` to 500 or more) before including any header. */
+#ifdef JRSL_MMAP
+#if defined(__GLIBC__) && defined(__STRICT_ANSI__) &&                          \
+    !defined(_GNU_SOURCE) && !defined(_DEFAULT_SOURCE) &&                      \
+    !defined(_BSD_SOURCE) &&                                                   \
+    !(defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L) &&               \
+    !(defined(_XOPEN_SOURCE) && _XOPEN_SOURCE >= 500)
+#error "JRSL_MMAP needs _POSIX_C_SOURCE >= 200112L or _XOPEN_SOURCE >= 500"
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Functions defined in this header even without `JRSL_IMPLEMENTATION` */
+#if defined(__GNUC__)
+#define JRSL_STATIC static __inline__ __attribute__((unused))
+#elif defined(_MSC_VER)
+#define JRSL_STATIC static __inline
+#else
+#define JRSL_STATIC static
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -64,22 +206,294 @@ typedef char (*comparator_t)(void *key1, void *key2);
 typedef void (*key_destructor_t)(void *key);
 typedef void (*node_visitor_t)(void *key, void *data);
 typedef void (*label_printer_t)(void *key, void *data);
+typedef void *(*merge_policy_t)(void *key, void *data, void *other_key,
+                                void *other_data);
 
 struct skip_node_t;
 struct link {
   size_t width;
   struct skip_node_t *node;
+#ifdef JRSL_AGGREGATE
+  /* The aggregate of the `width` elements the link spans, the last one being
+   * `node` */
+  JRSL_AGGREGATE aggregate;
+#endif
 };
 
 typedef struct skip_node_t {
-  struct link *forward;
-
   void *key;
   void *data;
+
+  /* Length of the `forward` array */
+  unsigned short level;
+
+#ifdef JRSL_BACKWARD
+  /* The previous node on the lowest level, NULL for the first node */
+  struct skip_node_t *backward;
+#endif
+
+#ifdef JRSL_SNAPSHOTS
+  /* The versions of the list which inserted and removed the element, `death`
+   * is 0 while it is in the list */
+  unsigned long birth;
+  unsigned long death;
+  /* The next node on the lowest level for the snapshots, removed nodes some
+   * snapshot may still see stay on this chain */
+  struct skip_node_t *snapshot_next;
+  /* Chains the removed nodes waiting for the snapshots */
+  struct skip_node_t *snapshot_garbage;
+#endif
+
+  /* The links to the next nodes. The array is allocated inline with the node,
+   * so `forward` must stay the last member and actually holds `level` links.
+   */
+  struct link forward[1];
 } skip_node_t;
 
-typedef struct skip_list_t {
-  /* Maximum level for this skip list */
+/* Size in bytes of a node holding `level` links. */
+#define JRSL_NODE_SIZE(level)                                                  \
+  (offsetof(skip_node_t, forward) + (level) * sizeof(struct link))
+
+/* Allocates `size` bytes for a node with `level` links. Returns NULL on
+ * failure. */
+typedef void *(*jrsl_alloc_t)(void *context, size_t size, unsigned short level);
+/* Frees a node previously returned by the matching `jrsl_alloc_t` with the
+ * same `size` and `level`. */
+typedef void (*jrsl_free_t)(void *context, void *ptr, size_t size,
+                            unsigned short level);
+/* Frees every node allocated so far at once. */
+typedef void (*jrsl_release_t)(void *context);
+
+/* The allocator used for the nodes (and the head) of a skip list. */
+typedef struct jrsl_allocator_t {
+  jrsl_alloc_t alloc;
+  jrsl_free_t free;
+  /* Optional, may be NULL. Lets `jrsl_destroy` drop every node without
+   * walking the list. */
+  jrsl_release_t release;
+  void *context;
+} jrsl_allocator_t;
+
+#ifdef JRSL_AGGREGATE
+/* The value of a single element, for instance a numeric field of `data`. */
+typedef JRSL_AGGREGATE (*jrsl_measure_t)(void *key, void *data);
+/* An associative operation (sum, min, max, ...), `a` coming before `b`. */
+typedef JRSL_AGGREGATE (*jrsl_combine_t)(JRSL_AGGREGATE a, JRSL_AGGREGATE b);
+
+/* What `jrsl_prefix_aggregate` and `jrsl_range_aggregate` compute. */
+typedef struct jrsl_aggregator_t {
+  jrsl_measure_t measure;
+  jrsl_combine_t combine;
+  /* The aggregate of no element, `combine(identity, a)` must be `a` */
+  JRSL_AGGREGATE identity;
+} jrsl_aggregator_t;
+#endif
+
+struct jrsl_codec_t;
+/* Writes or reads exactly `size` bytes. Returns 0 on success. */
+typedef int (*jrsl_write_t)(void *context, const void *buffer, size_t size);
+typedef int (*jrsl_read_t)(void *context, void *buffer, size_t size);
+/* Writes an element with `codec->write`, or reads one back with `codec->read`.
+ * Returns 0 on success. */
+typedef int (*jrsl_encode_t)(const struct jrsl_codec_t *codec, void *key,
+                             void *data);
+typedef int (*jrsl_decode_t)(const struct jrsl_codec_t *codec, void **key,
+                             void **data);
+
+/* The stream and the element format used by `jrsl_serialize` and
+ * `jrsl_deserialize`. Only the members used by one of them need be set. */
+typedef struct jrsl_codec_t {
+  jrsl_write_t write;
+  jrsl_read_t read;
+  void *context;
+  jrsl_encode_t encode;
+  jrsl_decode_t decode;
+} jrsl_codec_t;
+
+#ifdef JRSL_WAL
+/* A write-ahead log: records are copied to `buffer`, which is written to the
+ * stream of `sink` in one call when it is full or flushed. */
+typedef struct jrsl_log_t {
+  unsigned char *buffer;
+  size_t size;
+  size_t used;
+  /* The stream and the element encoder given by the user */
+  jrsl_codec_t sink;
+  /* The same encoder, writing to `buffer` */
+  jrsl_codec_t codec;
+  /* The first error of the stream or of the encoder, 0 if none */
+  int error;
+} jrsl_log_t;
+#endif
+
+#ifdef JRSL_STATS
+/* The counters of a skip list, see `jrsl_stats_snapshot`. */
+typedef struct jrsl_stats_t {
+  /* Calls of the comparator */
+  size_t comparisons;
+  /* Descents from the head (or from a cursor path), and the forward links
+   * they followed */
+  size_t operations;
+  size_t hops;
+  /* Nodes given by and back to the allocator, the head included */
+  size_t allocations;
+  size_t frees;
+
+  /* Only set by `jrsl_stats_snapshot` */
+  size_t width;
+  unsigned short level;
+  /* `nodes[i]` is the number of nodes with more than `i` levels */
+  size_t nodes[JRSL_MAX_LEVEL];
+  /* Forward hops per descent */
+  double average_path;
+} jrsl_stats_t;
+#endif
+
+/* A size class of the slab allocator. */
+struct jrsl_slab_class_t {
+  /* Singly linked list of freed nodes, the next pointer is stored in the
+   * freed node itself. */
+  void *free_list;
+  /* The unused part of the last chunk of this class. */
+  char *cursor;
+  char *end;
+};
+
+/* A slab allocator with one size class per level. Nodes are carved out of big
+ * chunks and recycled through per-level free lists. */
+typedef struct jrsl_slab_t {
+  /* Amount of nodes in each chunk */
+  size_t chunk_nodes;
+
+  /* Size classes, `classes[i]` holds nodes of level `i + 1` */
+  unsigned short class_count;
+  struct jrsl_slab_class_t *classes;
+
+  /* Linked list of every chunk, used to release the slab. */
+  void *chunks;
+} jrsl_slab_t;
+
+/* The random generator drawing the levels of a skip list. Every list has its
+ * own, so lists used by different threads don't share any state and a seeded
+ * list always gets the same levels. */
+typedef struct jrsl_rng_t {
+  /* xorshift32 state, only the low 32 bits are used */
+  unsigned long state;
+  /* log2(1/p) when p is a power of 1/2, 0 otherwise */
+  unsigned short shift;
+  /* p * 2^32, for any other p */
+  unsigned long threshold;
+} jrsl_rng_t;
+
+/* Count of trailing zeros of a non zero 32 bits value */
+#if defined(__GNUC__)
+#define JRSL_CTZ32(x) ((unsigned short)__builtin_ctzl(x))
+#else
+JRSL_STATIC unsigned short jrsl_ctz32(unsigned long x) {
+  unsigned short n = 0;
+  while (!(x & 1UL)) {
+    x >>= 1;
+    ++n;
+  }
+  return n;
+}
+#define JRSL_CTZ32(x) jrsl_ctz32(x)
+#endif
+
+/* Seeds a level generator for the probability `p`. */
+JRSL_STATIC void jrsl_rng_init(jrsl_rng_t *rng, float p, unsigned long seed) {
+  unsigned short k;
+
+  /* xorshift must not start from 0 */
+  seed &= 0xFFFFFFFFUL;
+  rng->state = seed ? seed : 2463534242UL;
+
+  rng->shift = 0;
+  for (k = 1; k < 16; ++k) {
+    if (p == 1.0f / (1UL << k)) {
+      rng->shift = k;
+      break;
+    }
+  }
+  rng->threshold =
+      p >= 1 ? 0xFFFFFFFFUL : (p <= 0 ? 0 : (unsigned long)(p * 4294967296.0));
+}
+
+/* Returns the next 32 random bits of the generator. */
+JRSL_STATIC unsigned long jrsl_rng_next(jrsl_rng_t *rng) {
+  unsigned long x = rng->state;
+  x ^= (x << 13) & 0xFFFFFFFFUL;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xFFFFFFFFUL;
+  rng->state = x;
+  return x;
+}
+
+/* Draws the level of a new node: each level above the first is added with
+ * probability `p`, up to `max_level - 1`. When p = 1/2^k a single draw is
+ * enough, every k trailing zero bits add a level. */
+JRSL_STATIC unsigned short jrsl_draw_level(jrsl_rng_t *rng,
+                                           unsigned short max_level) {
+  unsigned short level = 1;
+
+  if (rng->shift) {
+    unsigned long rnd = jrsl_rng_next(rng);
+    level += (rnd ? JRSL_CTZ32(rnd) : 32) / rng->shift;
+  } else {
+    while (jrsl_rng_next(rng) < rng->threshold && level < max_level - 1)
+      level++;
+  }
+
+  if (level > max_level - 1)
+    level = max_level > 1 ? max_level - 1 : 1;
+  return level;
+}
+
+/* The default allocator of skip lists, forwards to malloc and free. */
+JRSL_STATIC void *jrsl_default_alloc(void *context, size_t size,
+                                     unsigned short level) {
+  (void)context;
+  (void)level;
+  return malloc(size);
+}
+
+JRSL_STATIC void jrsl_default_free(void *context, void *ptr, size_t size,
+                                   unsigned short level) {
+  (void)context;
+  (void)size;
+  (void)level;
+  free(ptr);
+}
+
+typedef struct skip_list_t skip_list_t;
+
+/* A position in a skip list that remembers its search path, so that moving it
+ * by a short distance only costs O(log d) where d is the distance traveled.
+ * Any modification of the skip list invalidates its cursors. */
+typedef struct jrsl_cursor_t {
+  skip_list_t *skip_list;
+
+  /* The last node before the position on each level and its rank (the head
+   * has rank 0). The rank of `update[0]` is the index of the position. */
+  skip_node_t *update[JRSL_MAX_LEVEL];
+  size_t rank[JRSL_MAX_LEVEL];
+} jrsl_cursor_t;
+
+#ifdef JRSL_SNAPSHOTS
+/* A point-in-time view of a skip list, see `jrsl_snapshot_open`. */
+typedef struct jrsl_snapshot_t {
+  skip_list_t *skip_list;
+  /* The version of the list it sees */
+  unsigned long version;
+  /* The open snapshots of the list, from the oldest to the newest */
+  struct jrsl_snapshot_t *older;
+  struct jrsl_snapshot_t *newer;
+} jrsl_snapshot_t;
+#endif
+
+struct skip_list_t {
+  /* Maximum level for this skip list, at most `JRSL_MAX_LEVEL`. It grows
+   * when the width reaches `grow_width`. */
   unsigned short max_level;
   /* The probabilty to add a new level.
    * p is probability so we must have 0<= p <= 1 */
@@ -88,21 +502,148 @@ typedef struct skip_list_t {
   /* Maximum length of a `forward` array */
   unsigned short level;
   size_t width;
+  /* The width from which `max_level` is too low */
+  size_t grow_width;
 
   skip_node_t *head;
+  /* The last node, NULL if the list is empty */
+  skip_node_t *tail;
 
   comparator_t comparator;
   key_destructor_t key_destructor;
-} skip_list_t;
+
+  jrsl_allocator_t allocator;
+  jrsl_rng_t rng;
+  /* Set by `jrsl_set_deterministic` */
+  char deterministic;
+
+#ifdef JRSL_OPTIMISTIC
+  /* Odd while a writer is updating the list */
+  unsigned long version;
+  /* Removed nodes, chained through their data, see `jrsl_reclaim` */
+  skip_node_t *retired;
+#endif
+
+#ifdef JRSL_WAL
+  /* Where the updates are logged, NULL if they are not */
+  jrsl_log_t *log;
+#endif
+
+#ifdef JRSL_STATS
+  jrsl_stats_t stats;
+#endif
+
+#ifdef JRSL_AGGREGATE
+  /* Its `combine` is NULL until `jrsl_set_aggregator` is called */
+  jrsl_aggregator_t aggregator;
+#endif
+
+#ifdef JRSL_SNAPSHOTS
+  /* Incremented by `jrsl_snapshot_open`, the nodes are stamped with it */
+  unsigned long snapshot_version;
+  /* The open snapshots, NULL if there is none */
+  jrsl_snapshot_t *oldest;
+  jrsl_snapshot_t *newest;
+  /* The removed nodes still on the snapshot chain, and the ones which left it
+   * while snapshots were open, chained through `snapshot_garbage` */
+  skip_node_t *dead;
+  skip_node_t *garbage;
+#endif
+};
 
 void jrsl_initialize(skip_list_t *skip_list, comparator_t comparator,
                      key_destructor_t key_destructor, float p,
                      unsigned short max_level);
 void jrsl_destroy(skip_list_t *skip_list, node_visitor_t node_visitor);
+void jrsl_set_allocator(skip_list_t *skip_list,
+                        const jrsl_allocator_t *allocator);
+void jrsl_seed(skip_list_t *skip_list, unsigned long seed);
+void jrsl_set_deterministic(skip_list_t *skip_list);
+#ifdef JRSL_AGGREGATE
+void jrsl_set_aggregator(skip_list_t *skip_list,
+                         const jrsl_aggregator_t *aggregator);
+#endif
+#ifdef JRSL_OPTIMISTIC
+void jrsl_reclaim(skip_list_t *skip_list);
+#endif
+
+void jrsl_slab_init(jrsl_slab_t *slab, size_t chunk_nodes);
+void jrsl_slab_release(jrsl_slab_t *slab);
+jrsl_allocator_t jrsl_slab_allocator(jrsl_slab_t *slab);
 
 void *jrsl_search(skip_list_t *skip_list, void *key);
+void jrsl_search_many(skip_list_t *skip_list, void **keys, size_t n,
+                      void **out);
+skip_node_t *jrsl_lower_bound(skip_list_t *skip_list, void *key, size_t *rank);
+skip_node_t *jrsl_upper_bound(skip_list_t *skip_list, void *key, size_t *rank);
+size_t jrsl_range(skip_list_t *skip_list, void *lo, void *hi,
+                  node_visitor_t node_visitor, size_t *first_rank);
+size_t jrsl_range_reverse(skip_list_t *skip_list, void *lo, void *hi,
+                          node_visitor_t node_visitor, size_t *end_rank);
+#ifdef JRSL_AGGREGATE
+JRSL_AGGREGATE jrsl_prefix_aggregate(skip_list_t *skip_list, void *key);
+JRSL_AGGREGATE jrsl_range_aggregate(skip_list_t *skip_list, void *lo,
+                                    void *hi);
+#endif
+skip_node_t *jrsl_first(skip_list_t *skip_list);
+skip_node_t *jrsl_last(skip_list_t *skip_list);
+skip_node_t *jrsl_next(skip_node_t *node);
+skip_node_t *jrsl_prev(skip_list_t *skip_list, skip_node_t *node);
 void *jrsl_insert(skip_list_t *skip_list, void *key, void *data);
+void jrsl_insert_batch(skip_list_t *skip_list, void **keys, void **data,
+                       size_t n, void **old_data);
 void *jrsl_remove(skip_list_t *skip_list, void *key);
+void *jrsl_remove_at(skip_list_t *skip_list, size_t index);
+size_t jrsl_remove_range(skip_list_t *skip_list, size_t lo, size_t hi,
+                         node_visitor_t node_visitor);
+size_t jrsl_remove_keys(skip_list_t *skip_list, void *lo, void *hi,
+                        node_visitor_t node_visitor);
+
+void jrsl_build_sorted(skip_list_t *skip_list, void **keys, void **data,
+                       size_t n);
+
+void jrsl_split_at(skip_list_t *skip_list, size_t index, skip_list_t *right);
+void jrsl_split_key(skip_list_t *skip_list, void *key, skip_list_t *right);
+void jrsl_concat(skip_list_t *left, skip_list_t *right);
+void jrsl_merge(skip_list_t *a, skip_list_t *b, merge_policy_t policy);
+size_t jrsl_rebalance(skip_list_t *skip_list, size_t start, size_t count);
+
+int jrsl_serialize(skip_list_t *skip_list, const jrsl_codec_t *codec,
+                   char levels);
+int jrsl_deserialize(skip_list_t *skip_list, const jrsl_codec_t *codec);
+int jrsl_file_write(void *context, const void *buffer, size_t size);
+int jrsl_file_read(void *context, void *buffer, size_t size);
+
+#ifdef JRSL_WAL
+void jrsl_log_init(jrsl_log_t *log, size_t size, const jrsl_codec_t *codec);
+int jrsl_log_flush(jrsl_log_t *log);
+void jrsl_log_destroy(jrsl_log_t *log);
+void jrsl_set_log(skip_list_t *skip_list, jrsl_log_t *log);
+size_t jrsl_replay(skip_list_t *skip_list, const jrsl_codec_t *codec);
+#endif
+
+#ifdef JRSL_STATS
+void jrsl_stats_snapshot(skip_list_t *skip_list, jrsl_stats_t *stats);
+void jrsl_stats_reset(skip_list_t *skip_list);
+void jrsl_print_stats(const jrsl_stats_t *stats);
+#endif
+
+#ifdef JRSL_SNAPSHOTS
+void jrsl_snapshot_open(skip_list_t *skip_list, jrsl_snapshot_t *snapshot);
+void jrsl_snapshot_close(jrsl_snapshot_t *snapshot);
+skip_node_t *jrsl_snapshot_first(jrsl_snapshot_t *snapshot);
+skip_node_t *jrsl_snapshot_next(jrsl_snapshot_t *snapshot, skip_node_t *node);
+void *jrsl_snapshot_search(jrsl_snapshot_t *snapshot, void *key);
+#endif
+
+void jrsl_cursor_init(jrsl_cursor_t *cursor, skip_list_t *skip_list);
+void *jrsl_cursor_seek(jrsl_cursor_t *cursor, void *key);
+void *jrsl_cursor_seek_index(jrsl_cursor_t *cursor, size_t index);
+int jrsl_cursor_next(jrsl_cursor_t *cursor);
+int jrsl_cursor_prev(jrsl_cursor_t *cursor);
+size_t jrsl_cursor_index(jrsl_cursor_t *cursor);
+void *jrsl_cursor_key(jrsl_cursor_t *cursor);
+void *jrsl_cursor_data(jrsl_cursor_t *cursor);
 
 void jrsl_display_list(skip_list_t *skip_list, label_printer_t label_printor);
 
@@ -116,348 +657,4959 @@ static void jrsl_init_head(skip_list_t *skip_list);
 static skip_node_t *jrsl_node_at(skip_list_t *skip_list, size_t index);
 void *jrsl_data_at(skip_list_t *skip_list, size_t index);
 void *jrsl_key_at(skip_list_t *skip_list, size_t index);
+size_t jrsl_rank(skip_list_t *skip_list, void *key);
 
-#ifdef __cplusplus
-}
-#endif
+/* ============================= TYPED SKIP LISTS =============================
+ * `JRSL_DEFINE(name, key_type, cmp)` generates a skip list type `name_t` whose
+ * keys are stored by value inside the nodes and compared inline with
+ * `cmp(a, b)`, which must return a negative, zero or positive value like
+ * `strcmp`. It can be a function or a macro, `JRSL_CMP_NUMBER` works for any
+ * arithmetic type. The functions are static and do not need
+ * `JRSL_IMPLEMENTATION`:
+ *
+ *    JRSL_DEFINE(u64_list, unsigned long, JRSL_CMP_NUMBER)
+ *
+ *    u64_list_t list;
+ *    u64_list_initialize(&list, 0.5f, 16);
+ *    u64_list_insert(&list, 42, data);
+ *    u64_list_search(&list, 42);
+ *
+ * The generated functions mirror the generic ones: `name_initialize`,
+ * `name_set_allocator`, `name_seed`, `name_destroy`, `name_search`,
+ * `name_insert`, `name_remove`, `name_key_at`, `name_data_at` and `name_rank`.
+ */
 
-#endif /*!JRSL_H*/
-#ifdef JRSL_IMPLEMENTATION
+#define JRSL_CMP_NUMBER(a, b) (((a) > (b)) - ((a) < (b)))
 
-/* Initializes the head of the skip list. Helper function used in
- * `jrsl_initialize`.*/
-static void jrsl_init_head(skip_list_t *skip_list) {
-  skip_node_t *head = (skip_node_t *)malloc(sizeof(skip_node_t));
-  if (!head) {
-    /* Malloc failure */
-    exit(EXIT_FAILURE);
+#define JRSL_DEFINE(name, key_type, cmp)                                       \
+  struct name##_node_t;                                                        \
+  struct name##_link {                                                         \
+    size_t width;                                                              \
+    struct name##_node_t *node;                                                \
+  };                                                                           \
+  typedef struct name##_node_t {                                               \
+    key_type key;                                                              \
+    void *data;                                                                \
+    unsigned short level;                                                      \
+    struct name##_link forward[1];                                             \
+  } name##_node_t;                                                             \
+  typedef struct name##_t {                                                    \
+    unsigned short max_level;                                                  \
+    float p;                                                                   \
+    unsigned short level;                                                      \
+    size_t width;                                                              \
+    name##_node_t *head;                                                       \
+    jrsl_allocator_t allocator;                                                \
+    jrsl_rng_t rng;                                                            \
+  } name##_t;                                                                  \
+  typedef void (*name##_visitor_t)(key_type key, void *data);                  \
+                                                                               \
+  JRSL_STATIC name##_node_t *name##_alloc_node(name##_t *list,                 \
+                                               unsigned short level) {         \
+    name##_node_t *node = (name##_node_t *)list->allocator.alloc(              \
+        list->allocator.context,                                               \
+        offsetof(name##_node_t, forward) + level * sizeof(struct name##_link), \
+        level);                                                                \
+    if (!node)                                                                 \
+      exit(EXIT_FAILURE);                                                      \
+    node->level = level;                                                       \
+    return node;                                                               \
+  }                                                                            \
+  JRSL_STATIC void name##_free_node(name##_t *list, name##_node_t *node) {     \
+    list->allocator.free(list->allocator.context, node,                        \
+                         offsetof(name##_node_t, forward) +                    \
+                             node->level * sizeof(struct name##_link),         \
+                         node->level);                                         \
+  }                                                                            \
+  JRSL_STATIC void name##_init_head(name##_t *list) {                          \
+    list->head = name##_alloc_node(list, list->max_level);                     \
+    list->head->data = NULL;                                                   \
+    list->head->forward[0].node = NULL;                                        \
+    list->head->forward[0].width = 0;                                          \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_initialize(name##_t *list, float p,                  \
+                                     unsigned short max_level) {               \
+    assert(max_level <= JRSL_MAX_LEVEL);                                       \
+    list->level = 1U;                                                          \
+    list->width = 0;                                                           \
+    list->max_level = max_level;                                               \
+    list->p = p;                                                               \
+    list->allocator.alloc = jrsl_default_alloc;                                \
+    list->allocator.free = jrsl_default_free;                                  \
+    list->allocator.release = NULL;                                            \
+    list->allocator.context = NULL;                                            \
+    jrsl_rng_init(&list->rng, p, 0);                                           \
+    name##_init_head(list);                                                    \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_seed(name##_t *list, unsigned long seed) {           \
+    jrsl_rng_init(&list->rng, list->p, seed);                                  \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_set_allocator(name##_t *list,                        \
+                                        const jrsl_allocator_t *allocator) {   \
+    assert(list->width == 0);                                                  \
+    name##_free_node(list, list->head);                                        \
+    list->allocator = *allocator;                                              \
+    name##_init_head(list);                                                    \
+  }                                                                            \
+                                                                               \
+  /* Unlike `jrsl_destroy`, the visitor is not applied to the head. */         \
+  JRSL_STATIC void name##_destroy(name##_t *list, name##_visitor_t visitor) {  \
+    name##_node_t *node = list->head->forward[0].node;                         \
+    if (!visitor && list->allocator.release) {                                 \
+      list->allocator.release(list->allocator.context);                        \
+      return;                                                                  \
+    }                                                                          \
+    if (!list->allocator.release)                                              \
+      name##_free_node(list, list->head);                                      \
+    while (node) {                                                             \
+      name##_node_t *next = node->forward[0].node;                             \
+      if (visitor)                                                             \
+        visitor(node->key, node->data);                                        \
+      if (!list->allocator.release)                                            \
+        name##_free_node(list, node);                                          \
+      node = next;                                                             \
+    }                                                                          \
+    if (list->allocator.release)                                               \
+      list->allocator.release(list->allocator.context);                        \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_search(name##_t *list, key_type key) {              \
+    size_t i;                                                                  \
+    name##_node_t *x = list->head;                                             \
+    for (i = list->level; i > 0; --i) {                                        \
+      while (x->forward[i - 1].node != NULL &&                                 \
+             cmp(x->forward[i - 1].node->key, key) < 0)                        \
+        x = x->forward[i - 1].node;                                            \
+    }                                                                          \
+    x = x->forward[0].node;                                                    \
+    if (x && cmp(x->key, key) == 0)                                            \
+      return x->data;                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_insert(name##_t *list, key_type key, void *data) {  \
+    size_t i;                                                                  \
+    name##_node_t *x = list->head;                                             \
+    size_t rank = 0;                                                           \
+    unsigned short level;                                                      \
+    name##_node_t *update[JRSL_MAX_LEVEL];                                     \
+    size_t update_rank[JRSL_MAX_LEVEL];                                        \
+    name##_node_t *new_node;                                                   \
+                                                                               \
+    for (i = list->level; i > 0; --i) {                                        \
+      while (x->forward[i - 1].node != NULL &&                                 \
+             cmp(x->forward[i - 1].node->key, key) < 0) {                      \
+        rank += x->forward[i - 1].width;                                       \
+        x = x->forward[i - 1].node;                                            \
+      }                                                                        \
+      update[i - 1] = x;                                                       \
+      update_rank[i - 1] = rank;                                               \
+    }                                                                          \
+                                                                               \
+    x = x->forward[0].node;                                                    \
+    if (x && cmp(x->key, key) == 0) {                                          \
+      void *old = x->data;                                                     \
+      x->data = data;                                                          \
+      return old;                                                              \
+    }                                                                          \
+                                                                               \
+    level = jrsl_draw_level(&list->rng, list->max_level);                      \
+    assert(level < list->max_level);                                           \
+    if (level > list->level) {                                                 \
+      for (i = list->level; i < level; ++i) {                                  \
+        update[i] = list->head;                                                \
+        update_rank[i] = 0;                                                    \
+        list->head->forward[i].node = NULL;                                    \
+        list->head->forward[i].width = 0;                                      \
+      }                                                                        \
+      list->level = level;                                                     \
+    }                                                                          \
+                                                                               \
+    new_node = name##_alloc_node(list, level);                                 \
+    new_node->key = key;                                                       \
+    new_node->data = data;                                                     \
+                                                                               \
+    rank = update_rank[0] + 1;                                                 \
+    for (i = 0; i < level; ++i) {                                              \
+      struct name##_link *link = &update[i]->forward[i];                       \
+      new_node->forward[i].node = link->node;                                  \
+      new_node->forward[i].width =                                             \
+          link->node ? update_rank[i] + link->width + 1 - rank : 0;            \
+      link->node = new_node;                                                   \
+      link->width = rank - update_rank[i];                                     \
+    }                                                                          \
+    for (i = level; i < list->level && update[i]->forward[i].node; ++i)        \
+      ++update[i]->forward[i].width;                                           \
+                                                                               \
+    list->width++;                                                             \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_remove(name##_t *list, key_type key) {              \
+    size_t i;                                                                  \
+    name##_node_t *x = list->head;                                             \
+    name##_node_t *update[JRSL_MAX_LEVEL];                                     \
+    void *old;                                                                 \
+                                                                               \
+    for (i = list->level; i > 0; --i) {                                        \
+      while (x->forward[i - 1].node != NULL &&                                 \
+             cmp(x->forward[i - 1].node->key, key) < 0)                        \
+        x = x->forward[i - 1].node;                                            \
+      update[i - 1] = x;                                                       \
+    }                                                                          \
+    x = x->forward[0].node;                                                    \
+    if (!x || cmp(x->key, key) != 0)                                           \
+      return NULL;                                                             \
+                                                                               \
+    for (i = 0; i < list->level; ++i) {                                        \
+      struct name##_link *link = &update[i]->forward[i];                       \
+      if (link->node == x) {                                                   \
+        link->node = x->forward[i].node;                                       \
+        if (x->forward[i].node)                                                \
+          link->width += x->forward[i].width - 1;                              \
+        else                                                                   \
+          link->width = 0;                                                     \
+      } else if (link->node) {                                                 \
+        --link->width;                                                         \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    old = x->data;                                                             \
+    name##_free_node(list, x);                                                 \
+    list->width--;                                                             \
+                                                                               \
+    while (list->level > 1 && !list->head->forward[list->level - 1].node)      \
+      --list->level;                                                           \
+    return old;                                                                \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC name##_node_t *name##_node_at(name##_t *list, size_t index) {    \
+    size_t i;                                                                  \
+    size_t w = index + 1;                                                      \
+    name##_node_t *x = list->head;                                             \
+    if (index >= list->width)                                                  \
+      return NULL;                                                             \
+    for (i = list->level; i > 0; --i) {                                        \
+      while (x->forward[i - 1].node && x->forward[i - 1].width <= w) {         \
+        w -= x->forward[i - 1].width;                                          \
+        x = x->forward[i - 1].node;                                            \
+        if (w == 0)                                                            \
+          return x;                                                            \
+      }                                                                        \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC key_type *name##_key_at(name##_t *list, size_t index) {          \
+    name##_node_t *node = name##_node_at(list, index);                         \
+    if (node)                                                                  \
+      return &node->key;                                                       \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_data_at(name##_t *list, size_t index) {             \
+    name##_node_t *node = name##_node_at(list, index);                         \
+    if (node)                                                                  \
+      return node->data;                                                       \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC size_t name##_rank(name##_t *list, key_type key) {               \
+    size_t i;                                                                  \
+    size_t rank = 0;                                                           \
+    name##_node_t *x = list->head;                                             \
+    for (i = list->level; i > 0; --i) {                                        \
+      while (x->forward[i - 1].node != NULL &&                                 \
+             cmp(x->forward[i - 1].node->key, key) < 0) {                      \
+        rank += x->forward[i - 1].width;                                       \
+        x = x->forward[i - 1].node;                                            \
+      }                                                                        \
+    }                                                                          \
+    return rank;                                                               \
   }
 
-  head->data = NULL;
-  head->key = NULL;
-  head->forward =
-      (struct link *)malloc(skip_list->max_level * sizeof(struct link));
-  if (!head->forward) {
-    /* Malloc failure */
-    exit(EXIT_FAILURE);
+/* ============================ UNROLLED SKIP LISTS ===========================
+ * `JRSL_DEFINE_UNROLLED(name, key_type, cmp, block)` generates a typed skip
+ * list `name_t` whose nodes are sorted blocks of up to `block` keys (and their
+ * data) stored inline. The levels index the blocks, so a search only follows a
+ * few links before scanning a block, much like a B-tree.
+ *
+ * Widths count elements, not blocks: the width of a link is the number of
+ * elements between the ends of the two blocks. A full block is split in two
+ * halves when a key is inserted in it, and an empty one is unlinked. Blocks are
+ * never merged.
+ *
+ * `block` must be at least 2. 8 to 32 keys per block, so that a block holds
+ * one or two cache lines of keys, work well. The generated functions are the
+ * same as `JRSL_DEFINE`'s, but `name_key_at` points inside a block and is
+ * invalidated by any update.
+ *
+ * `JRSL_DEFINE_UNROLLED_SCAN(name, key_type, cmp, block, scan)` replaces the
+ * scan of a block with `scan(keys, count, key)`, which must return the number
+ * of keys less than `key` in the sorted array `keys`, in the order of `cmp`.
+ * `jrsl_scan_u32` and `jrsl_scan_u64` compare several keys at once with SIMD
+ * instructions:
+ *
+ *    JRSL_DEFINE_UNROLLED_SCAN(prices, jrsl_u64_t, JRSL_CMP_NUMBER, 16,
+ *                              jrsl_scan_u64)
+ */
+
+#define JRSL_DEFINE_UNROLLED_SCAN(name, key_type, cmp, block, scan)            \
+  struct name##_node_t;                                                        \
+  struct name##_link {                                                         \
+    size_t width;                                                              \
+    struct name##_node_t *node;                                                \
+  };                                                                           \
+  typedef struct name##_node_t {                                               \
+    unsigned short count;                                                      \
+    unsigned short level;                                                      \
+    key_type keys[block];                                                      \
+    void *data[block];                                                         \
+    struct name##_link forward[1];                                             \
+  } name##_node_t;                                                             \
+  typedef struct name##_t {                                                    \
+    unsigned short max_level;                                                  \
+    float p;                                                                   \
+    unsigned short level;                                                      \
+    size_t width;                                                              \
+    name##_node_t *head;                                                       \
+    jrsl_allocator_t allocator;                                                \
+    jrsl_rng_t rng;                                                            \
+  } name##_t;                                                                  \
+  typedef void (*name##_visitor_t)(key_type key, void *data);                  \
+                                                                               \
+  JRSL_STATIC name##_node_t *name##_alloc_node(name##_t *list,                 \
+                                               unsigned short level) {         \
+    name##_node_t *node = (name##_node_t *)list->allocator.alloc(              \
+        list->allocator.context,                                               \
+        offsetof(name##_node_t, forward) + level * sizeof(struct name##_link), \
+        level);                                                                \
+    if (!node)                                                                 \
+      exit(EXIT_FAILURE);                                                      \
+    node->level = level;                                                       \
+    node->count = 0;                                                           \
+    return node;                                                               \
+  }                                                                            \
+  JRSL_STATIC void name##_free_node(name##_t *list, name##_node_t *node) {     \
+    list->allocator.free(list->allocator.context, node,                        \
+                         offsetof(name##_node_t, forward) +                    \
+                             node->level * sizeof(struct name##_link),         \
+                         node->level);                                         \
+  }                                                                            \
+  JRSL_STATIC void name##_init_head(name##_t *list) {                          \
+    unsigned short i;                                                          \
+    list->head = name##_alloc_node(list, list->max_level);                     \
+    for (i = 0; i < list->max_level; ++i) {                                    \
+      list->head->forward[i].node = NULL;                                      \
+      list->head->forward[i].width = 0;                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_initialize(name##_t *list, float p,                  \
+                                     unsigned short max_level) {               \
+    assert(max_level <= JRSL_MAX_LEVEL);                                       \
+    list->level = 1U;                                                          \
+    list->width = 0;                                                           \
+    list->max_level = max_level;                                               \
+    list->p = p;                                                               \
+    list->allocator.alloc = jrsl_default_alloc;                                \
+    list->allocator.free = jrsl_default_free;                                  \
+    list->allocator.release = NULL;                                            \
+    list->allocator.context = NULL;                                            \
+    jrsl_rng_init(&list->rng, p, 0);                                           \
+    name##_init_head(list);                                                    \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_seed(name##_t *list, unsigned long seed) {           \
+    jrsl_rng_init(&list->rng, list->p, seed);                                  \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_set_allocator(name##_t *list,                        \
+                                        const jrsl_allocator_t *allocator) {   \
+    assert(list->width == 0);                                                  \
+    name##_free_node(list, list->head);                                        \
+    list->allocator = *allocator;                                              \
+    name##_init_head(list);                                                    \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_destroy(name##_t *list, name##_visitor_t visitor) {  \
+    name##_node_t *node = list->head->forward[0].node;                         \
+    unsigned short j;                                                          \
+    if (!visitor && list->allocator.release) {                                 \
+      list->allocator.release(list->allocator.context);                        \
+      return;                                                                  \
+    }                                                                          \
+    if (!list->allocator.release)                                              \
+      name##_free_node(list, list->head);                                      \
+    while (node) {                                                             \
+      name##_node_t *next = node->forward[0].node;                             \
+      if (visitor)                                                             \
+        for (j = 0; j < node->count; ++j)                                      \
+          visitor(node->keys[j], node->data[j]);                               \
+      if (!list->allocator.release)                                            \
+        name##_free_node(list, node);                                          \
+      node = next;                                                             \
+    }                                                                          \
+    if (list->allocator.release)                                               \
+      list->allocator.release(list->allocator.context);                        \
+  }                                                                            \
+                                                                               \
+  /* Number of keys of the block less than `key` */                            \
+  JRSL_STATIC unsigned short name##_lower(const name##_node_t *node,           \
+                                          key_type key) {                      \
+    return scan(node->keys, node->count, key);                                 \
+  }                                                                            \
+                                                                               \
+  /* Fills `update` with the last block before the one `key` belongs to on     \
+   * every level, and `update_rank` with the number of elements up to the end  \
+   * of these blocks. The block of `key` is `update[0]->forward[0].node`. */   \
+  JRSL_STATIC void name##_find_before(name##_t *list, key_type key,            \
+                                      name##_node_t **update,                  \
+                                      size_t *update_rank) {                   \
+    size_t i;                                                                  \
+    name##_node_t *x = list->head;                                             \
+    size_t rank = 0;                                                           \
+    for (i = list->level; i > 0; --i) {                                        \
+      name##_node_t *next;                                                     \
+      while ((next = x->forward[i - 1].node) != NULL &&                        \
+             next->forward[0].node != NULL &&                                  \
+             cmp(next->forward[0].node->keys[0], key) <= 0) {                  \
+        rank += x->forward[i - 1].width;                                       \
+        x = next;                                                              \
+      }                                                                        \
+      update[i - 1] = x;                                                       \
+      update_rank[i - 1] = rank;                                               \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_search(name##_t *list, key_type key) {              \
+    size_t i;                                                                  \
+    unsigned short j;                                                          \
+    name##_node_t *x = list->head;                                             \
+    for (i = list->level; i > 0; --i) {                                        \
+      while (x->forward[i - 1].node != NULL &&                                 \
+             cmp(x->forward[i - 1].node->keys[0], key) <= 0)                   \
+        x = x->forward[i - 1].node;                                            \
+    }                                                                          \
+    if (x == list->head)                                                       \
+      return NULL;                                                             \
+    j = name##_lower(x, key);                                                  \
+    if (j < x->count && cmp(x->keys[j], key) == 0)                             \
+      return x->data[j];                                                       \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Splits the full block after `update[0]` in two halves, linking a new      \
+   * block after it. `update` and `update_rank` are moved to the block where   \
+   * `*j`, a position in the full block, ends up. */                           \
+  JRSL_STATIC name##_node_t *name##_split(name##_t *list,                      \
+                                          name##_node_t **update,              \
+                                          size_t *update_rank,                 \
+                                          unsigned short *j) {                 \
+    size_t i;                                                                  \
+    name##_node_t *x = update[0]->forward[0].node;                             \
+    unsigned short half = (unsigned short)(x->count / 2);                      \
+    size_t end = update_rank[0] + x->count;                                    \
+    unsigned short level = jrsl_draw_level(&list->rng, list->max_level);       \
+    name##_node_t *y;                                                          \
+                                                                               \
+    assert(level < list->max_level);                                           \
+    if (level > list->level) {                                                 \
+      for (i = list->level; i < level; ++i) {                                  \
+        update[i] = list->head;                                                \
+        update_rank[i] = 0;                                                    \
+        list->head->forward[i].node = NULL;                                    \
+        list->head->forward[i].width = 0;                                      \
+      }                                                                        \
+      list->level = level;                                                     \
+    }                                                                          \
+                                                                               \
+    y = name##_alloc_node(list, level);                                        \
+    y->count = half;                                                           \
+    x->count = (unsigned short)(x->count - half);                              \
+    memcpy(y->keys, x->keys + x->count, half * sizeof(key_type));              \
+    memcpy(y->data, x->data + x->count, half * sizeof(void *));                \
+                                                                               \
+    for (i = 0; i < list->level; ++i) {                                        \
+      if (i < x->level) {                                                      \
+        update[i]->forward[i].width -= half;                                   \
+        if (i < level) {                                                       \
+          y->forward[i] = x->forward[i];                                       \
+          x->forward[i].node = y;                                              \
+          x->forward[i].width = half;                                          \
+        } else if (x->forward[i].node) {                                       \
+          x->forward[i].width += half;                                         \
+        }                                                                      \
+      } else if (i < level) {                                                  \
+        struct name##_link *link = &update[i]->forward[i];                     \
+        y->forward[i].node = link->node;                                       \
+        y->forward[i].width =                                                  \
+            link->node ? update_rank[i] + link->width - end : 0;               \
+        link->node = y;                                                        \
+        link->width = end - update_rank[i];                                    \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    if (*j < x->count)                                                         \
+      return x;                                                                \
+    *j = (unsigned short)(*j - x->count);                                      \
+    for (i = 0; i < x->level; ++i) {                                           \
+      update[i] = x;                                                           \
+      update_rank[i] = end - half;                                             \
+    }                                                                          \
+    return y;                                                                  \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_insert(name##_t *list, key_type key, void *data) {  \
+    size_t i;                                                                  \
+    unsigned short j;                                                          \
+    name##_node_t *update[JRSL_MAX_LEVEL];                                     \
+    size_t update_rank[JRSL_MAX_LEVEL];                                        \
+    name##_node_t *x;                                                          \
+                                                                               \
+    name##_find_before(list, key, update, update_rank);                        \
+    x = update[0]->forward[0].node;                                            \
+                                                                               \
+    if (!x) {                                                                  \
+      /* The list is empty, starts the first block */                          \
+      unsigned short level = jrsl_draw_level(&list->rng, list->max_level);     \
+      assert(level < list->max_level);                                         \
+      x = name##_alloc_node(list, level);                                      \
+      for (i = 0; i < level; ++i) {                                            \
+        update[i] = list->head;                                                \
+        update_rank[i] = 0;                                                    \
+        x->forward[i].node = NULL;                                             \
+        x->forward[i].width = 0;                                               \
+        list->head->forward[i].node = x;                                       \
+        list->head->forward[i].width = 0;                                      \
+      }                                                                        \
+      if (level > list->level)                                                 \
+        list->level = level;                                                   \
+      j = 0;                                                                   \
+    } else {                                                                   \
+      j = name##_lower(x, key);                                                \
+      if (j < x->count && cmp(x->keys[j], key) == 0) {                         \
+        void *old = x->data[j];                                                \
+        x->data[j] = data;                                                     \
+        return old;                                                            \
+      }                                                                        \
+      if (x->count == block)                                                   \
+        x = name##_split(list, update, update_rank, &j);                       \
+    }                                                                          \
+                                                                               \
+    memmove(x->keys + j + 1, x->keys + j, (x->count - j) * sizeof(key_type));  \
+    memmove(x->data + j + 1, x->data + j, (x->count - j) * sizeof(void *));    \
+    x->keys[j] = key;                                                          \
+    x->data[j] = data;                                                         \
+    x->count++;                                                                \
+                                                                               \
+    /* Every link ending on the block or jumping over it gets longer */        \
+    for (i = 0; i < list->level && update[i]->forward[i].node; ++i)            \
+      ++update[i]->forward[i].width;                                           \
+                                                                               \
+    list->width++;                                                             \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_remove(name##_t *list, key_type key) {              \
+    size_t i;                                                                  \
+    unsigned short j;                                                          \
+    name##_node_t *update[JRSL_MAX_LEVEL];                                     \
+    size_t update_rank[JRSL_MAX_LEVEL];                                        \
+    name##_node_t *x;                                                          \
+    void *old;                                                                 \
+                                                                               \
+    name##_find_before(list, key, update, update_rank);                        \
+    x = update[0]->forward[0].node;                                            \
+    if (!x)                                                                    \
+      return NULL;                                                             \
+    j = name##_lower(x, key);                                                  \
+    if (j == x->count || cmp(x->keys[j], key) != 0)                            \
+      return NULL;                                                             \
+                                                                               \
+    old = x->data[j];                                                          \
+    x->count--;                                                                \
+    memmove(x->keys + j, x->keys + j + 1, (x->count - j) * sizeof(key_type));  \
+    memmove(x->data + j, x->data + j + 1, (x->count - j) * sizeof(void *));    \
+    for (i = 0; i < list->level && update[i]->forward[i].node; ++i)            \
+      --update[i]->forward[i].width;                                           \
+    list->width--;                                                             \
+                                                                               \
+    /* Empty blocks are unlinked */                                            \
+    if (x->count == 0) {                                                       \
+      for (i = 0; i < x->level; ++i) {                                         \
+        struct name##_link *link = &update[i]->forward[i];                     \
+        link->node = x->forward[i].node;                                       \
+        if (x->forward[i].node)                                                \
+          link->width += x->forward[i].width;                                  \
+        else                                                                   \
+          link->width = 0;                                                     \
+      }                                                                        \
+      name##_free_node(list, x);                                               \
+      while (list->level > 1 && !list->head->forward[list->level - 1].node)    \
+        --list->level;                                                         \
+    }                                                                          \
+    return old;                                                                \
+  }                                                                            \
+                                                                               \
+  /* Returns the block holding the element of index `index`, and stores the    \
+   * position of the element in the block in `j`. */                           \
+  JRSL_STATIC name##_node_t *name##_node_at(name##_t *list, size_t index,      \
+                                            unsigned short *j) {               \
+    size_t i;                                                                  \
+    size_t rank = 0;                                                           \
+    name##_node_t *x = list->head;                                             \
+    if (index >= list->width)                                                  \
+      return NULL;                                                             \
+    for (i = list->level; i > 0; --i) {                                        \
+      while (x->forward[i - 1].node &&                                         \
+             rank + x->forward[i - 1].width <= index) {                        \
+        rank += x->forward[i - 1].width;                                       \
+        x = x->forward[i - 1].node;                                            \
+      }                                                                        \
+    }                                                                          \
+    *j = (unsigned short)(index - rank);                                       \
+    return x->forward[0].node;                                                 \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC key_type *name##_key_at(name##_t *list, size_t index) {          \
+    unsigned short j;                                                          \
+    name##_node_t *node = name##_node_at(list, index, &j);                     \
+    if (node)                                                                  \
+      return &node->keys[j];                                                   \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_data_at(name##_t *list, size_t index) {             \
+    unsigned short j;                                                          \
+    name##_node_t *node = name##_node_at(list, index, &j);                     \
+    if (node)                                                                  \
+      return node->data[j];                                                    \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC size_t name##_rank(name##_t *list, key_type key) {               \
+    name##_node_t *update[JRSL_MAX_LEVEL];                                     \
+    size_t update_rank[JRSL_MAX_LEVEL];                                        \
+    name##_node_t *x;                                                          \
+    name##_find_before(list, key, update, update_rank);                        \
+    x = update[0]->forward[0].node;                                            \
+    return update_rank[0] + (x ? name##_lower(x, key) : 0);                    \
   }
 
-  head->forward[0].node = NULL;
-  head->forward[0].width = 0;
+#define JRSL_DEFINE_UNROLLED(name, key_type, cmp, block)                       \
+  JRSL_STATIC unsigned short name##_scan(const key_type *keys,                 \
+                                         unsigned short count, key_type key) { \
+    unsigned short j = 0;                                                      \
+    while (j < count && cmp(keys[j], key) < 0)                                 \
+      ++j;                                                                     \
+    return j;                                                                  \
+  }                                                                            \
+  JRSL_DEFINE_UNROLLED_SCAN(name, key_type, cmp, block, name##_scan)
 
-  skip_list->head = head;
+/* Fixed size keys for the block scans below. */
+typedef unsigned int jrsl_u32_t;
+#if defined(_MSC_VER)
+typedef unsigned __int64 jrsl_u64_t;
+#elif defined(__GNUC__)
+__extension__ typedef unsigned long long jrsl_u64_t;
+#else
+typedef unsigned long long jrsl_u64_t;
+#endif
+
+#if defined(__GNUC__)
+#define JRSL_POPCOUNT(x) ((unsigned short)__builtin_popcount(x))
+#else
+JRSL_STATIC unsigned short jrsl_popcount(unsigned int x) {
+  unsigned short n = 0;
+  for (; x; x &= x - 1)
+    ++n;
+  return n;
 }
+#define JRSL_POPCOUNT(x) jrsl_popcount(x)
+#endif
 
-/* Initializes a skip list. */
-void jrsl_initialize(skip_list_t *skip_list, comparator_t comparator,
-                     key_destructor_t key_destructor, float p,
-                     unsigned short max_level) {
-  skip_list->level = 1U;
-  skip_list->width = 0;
-  skip_list->max_level = max_level;
-  skip_list->p = p;
-  skip_list->comparator = comparator;
-  skip_list->key_destructor = key_destructor;
+/* Block scans for `JRSL_DEFINE_UNROLLED_SCAN`: return the number of keys less
+ * than `key` among the first `count` ones. A sorted block is scanned without
+ * any branch on the keys, several keys at a time with AVX2, SSE2 (SSE4.2 for
+ * 64 bits keys) or NEON, and the remaining keys one at a time. */
+JRSL_STATIC unsigned short jrsl_scan_u32(const jrsl_u32_t *keys,
+                                         unsigned short count, jrsl_u32_t key) {
+  unsigned short i = 0;
+  unsigned short n = 0;
+#if defined(JRSL_SIMD_AVX2)
+  /* There are only signed comparisons, flipping the sign bit keeps the order */
+  const __m256i bias = _mm256_set1_epi32((int)0x80000000U);
+  const __m256i probe = _mm256_xor_si256(_mm256_set1_epi32((int)key), bias);
+  for (; i + 8 <= count; i += 8) {
+    __m256i k = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(keys + i)), bias);
+    n += JRSL_POPCOUNT(
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(probe, k))));
+  }
+#elif defined(JRSL_SIMD_SSE2)
+  const __m128i bias = _mm_set1_epi32((int)0x80000000U);
+  const __m128i probe = _mm_xor_si128(_mm_set1_epi32((int)key), bias);
+  for (; i + 4 <= count; i += 4) {
+    __m128i k =
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + i)), bias);
+    n += JRSL_POPCOUNT(
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(k, probe))));
+  }
+#elif defined(JRSL_SIMD_NEON)
+  const uint32x4_t probe = vdupq_n_u32(key);
+  uint32x4_t acc = vdupq_n_u32(0);
+  /* Lanes of a true comparison are all ones, subtracting them counts them */
+  for (; i + 4 <= count; i += 4)
+    acc = vsubq_u32(acc, vcltq_u32(vld1q_u32(keys + i), probe));
+  n = (unsigned short)vaddvq_u32(acc);
+#endif
+  for (; i < count; ++i)
+    n += keys[i] < key;
+  return n;
+}
 
-  jrsl_init_head(skip_list);
+JRSL_STATIC unsigned short jrsl_scan_u64(const jrsl_u64_t *keys,
+                                         unsigned short count, jrsl_u64_t key) {
+  unsigned short i = 0;
+  unsigned short n = 0;
+#if defined(JRSL_SIMD_AVX2) || defined(JRSL_SIMD_SSE42)
+  const jrsl_u64_t sign = (jrsl_u64_t)1 << 63;
+#endif
+#if defined(JRSL_SIMD_AVX2)
+  const __m256i bias = _mm256_set1_epi64x(sign);
+  const __m256i probe = _mm256_xor_si256(_mm256_set1_epi64x(key), bias);
+  for (; i + 4 <= count; i += 4) {
+    __m256i k = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(keys + i)), bias);
+    n += JRSL_POPCOUNT(
+        _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(probe, k))));
+  }
+#elif defined(JRSL_SIMD_SSE42)
+  const __m128i bias = _mm_set1_epi64x(sign);
+  const __m128i probe = _mm_xor_si128(_mm_set1_epi64x(key), bias);
+  for (; i + 2 <= count; i += 2) {
+    __m128i k =
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + i)), bias);
+    n += JRSL_POPCOUNT(
+        _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(probe, k))));
+  }
+#elif defined(JRSL_SIMD_NEON)
+  const uint64x2_t probe = vdupq_n_u64(key);
+  uint64x2_t acc = vdupq_n_u64(0);
+  for (; i + 2 <= count; i += 2)
+    acc = vsubq_u64(acc, vcltq_u64(vld1q_u64(keys + i), probe));
+  n = (unsigned short)vaddvq_u64(acc);
+#endif
+  for (; i < count; ++i)
+    n += keys[i] < key;
+  return n;
 }
 
-/* Destroys a skip list. Node visitor is applied to every node before the node
- * is freed.*/
-void jrsl_destroy(skip_list_t *skip_list, node_visitor_t node_visitor) {
-  skip_node_t *node = skip_list->head;
-  while (node) {
-    skip_node_t *next_node = node->forward[0].node;
+/* ============================ COMPACT SKIP LISTS ============================
+ * `JRSL_DEFINE_COMPACT(name, key_type, cmp)` generates a typed skip list
+ * `name_t` whose nodes are stored in a single pool grown with `realloc` and
+ * linked by 32-bit indices, with 32-bit widths. A link takes 8 bytes instead of
+ * 16 on 64-bit targets, and nodes carry no allocator overhead: freed nodes are
+ * kept on one free list per level and reused.
+ *
+ * A list holds at most 2^32 - 1 elements, and the pool at most 2^31 units of
+ * `JRSL_COMPACT_UNIT` bytes, which must be a multiple of the alignment of
+ * `key_type`. The generated functions are the same as `JRSL_DEFINE`'s, without
+ * `name_set_allocator` and with `name_memory`, the size of the pool in bytes.
+ * Since an insertion may move the pool, `name_key_at` is invalidated by it.
+ */
 
-    node_visitor(node->key, node->data);
-    free(node->forward);
-    free(node);
-    node = next_node;
+#ifndef JRSL_COMPACT_UNIT
+#define JRSL_COMPACT_UNIT 8
+#endif
+
+/* Resizes the pool of a compact list from `size` to `new_size` bytes. When `fd`
+ * is not -1, the pool is a shared mapping of that file, which grows with it.
+ * Returns NULL on failure. */
+JRSL_STATIC unsigned char *jrsl_pool_resize(unsigned char *pool, size_t size,
+                                            size_t new_size, int fd) {
+#ifdef JRSL_MMAP
+  if (fd >= 0) {
+    void *map;
+    if (pool)
+      munmap(pool, size);
+    if (new_size > size && ftruncate(fd, (off_t)new_size) != 0)
+      return NULL;
+    map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? NULL : (unsigned char *)map;
   }
+#endif
+  (void)size;
+  (void)fd;
+  return (unsigned char *)realloc(pool, new_size);
 }
 
-/* Returns the node with index `index`. If `index` is greater than the width of
- * the skip list, returns NULL. This is a helper function used in `jrsl_key_at`
- * and `jrsl_data_at`.*/
-static skip_node_t *jrsl_node_at(skip_list_t *skip_list, size_t index) {
-  size_t i, w;
-  skip_node_t *x; /* skip node traveler */
+/* Frees the pool of a compact list, or unmaps and closes its file. */
+JRSL_STATIC void jrsl_pool_release(unsigned char *pool, size_t size, int fd) {
+#ifdef JRSL_MMAP
+  if (fd >= 0) {
+    if (pool)
+      munmap(pool, size);
+    close(fd);
+    return;
+  }
+#endif
+  (void)size;
+  (void)fd;
+  free(pool);
+}
 
-  if (index >= skip_list->width)
-    return NULL;
+#define JRSL_DEFINE_COMPACT(name, key_type, cmp)                               \
+  struct name##_link {                                                         \
+    jrsl_u32_t node;                                                           \
+    jrsl_u32_t width;                                                          \
+  };                                                                           \
+  typedef struct name##_node_t {                                               \
+    key_type key;                                                              \
+    void *data;                                                                \
+    jrsl_u32_t level;                                                          \
+    struct name##_link forward[1];                                             \
+  } name##_node_t;                                                             \
+  typedef struct name##_t {                                                    \
+    unsigned short max_level;                                                  \
+    float p;                                                                   \
+    unsigned short level;                                                      \
+    size_t width;                                                              \
+    jrsl_u32_t head;                                                           \
+    unsigned char *pool;                                                       \
+    int fd;                                                                    \
+    jrsl_u32_t used;                                                           \
+    jrsl_u32_t capacity;                                                       \
+    jrsl_u32_t free[JRSL_MAX_LEVEL];                                           \
+    jrsl_rng_t rng;                                                            \
+  } name##_t;                                                                  \
+  typedef void (*name##_visitor_t)(key_type key, void *data);                  \
+                                                                               \
+  JRSL_STATIC name##_node_t *name##_at(name##_t *list, jrsl_u32_t index) {     \
+    return (name##_node_t *)(list->pool + (size_t)index * JRSL_COMPACT_UNIT);  \
+  }                                                                            \
+  JRSL_STATIC jrsl_u32_t name##_units(unsigned short level) {                  \
+    return (jrsl_u32_t)((offsetof(name##_node_t, forward) +                    \
+                         level * sizeof(struct name##_link) +                  \
+                         JRSL_COMPACT_UNIT - 1) /                              \
+                        JRSL_COMPACT_UNIT);                                    \
+  }                                                                            \
+  JRSL_STATIC jrsl_u32_t name##_alloc_node(name##_t *list,                     \
+                                           unsigned short level) {             \
+    jrsl_u32_t index = list->free[level - 1];                                  \
+    if (index) {                                                               \
+      list->free[level - 1] = name##_at(list, index)->forward[0].node;         \
+    } else {                                                                   \
+      jrsl_u32_t units = name##_units(level);                                  \
+      if (list->capacity - list->used < units) {                               \
+        jrsl_u32_t capacity = list->capacity;                                  \
+        while (capacity - list->used < units) {                                \
+          if (capacity > 0x7FFFFFFFUL)                                         \
+            exit(EXIT_FAILURE);                                                \
+          capacity *= 2;                                                       \
+        }                                                                      \
+        list->pool = jrsl_pool_resize(                                         \
+            list->pool, (size_t)list->capacity * JRSL_COMPACT_UNIT,            \
+            (size_t)capacity * JRSL_COMPACT_UNIT, list->fd);                   \
+        if (!list->pool)                                                       \
+          exit(EXIT_FAILURE);                                                  \
+        list->capacity = capacity;                                             \
+      }                                                                        \
+      index = list->used;                                                      \
+      list->used += units;                                                     \
+    }                                                                          \
+    name##_at(list, index)->level = level;                                     \
+    return index;                                                              \
+  }                                                                            \
+  JRSL_STATIC void name##_free_node(name##_t *list, jrsl_u32_t index) {        \
+    name##_node_t *node = name##_at(list, index);                              \
+    node->forward[0].node = list->free[node->level - 1];                       \
+    list->free[node->level - 1] = index;                                       \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_init_pool(name##_t *list, float p,                   \
+                                    unsigned short max_level, int fd,          \
+                                    jrsl_u32_t reserved) {                     \
+    size_t i;                                                                  \
+    name##_node_t *head;                                                       \
+    /* The head follows the reserved units, the free lists start empty */      \
+    jrsl_u32_t units = reserved + name##_units(max_level);                     \
+    assert(max_level <= JRSL_MAX_LEVEL);                                       \
+    list->level = 1U;                                                          \
+    list->width = 0;                                                           \
+    list->max_level = max_level;                                               \
+    list->p = p;                                                               \
+    list->fd = fd;                                                             \
+    list->pool =                                                               \
+        jrsl_pool_resize(NULL, 0, (size_t)units * JRSL_COMPACT_UNIT, fd);      \
+    if (!list->pool)                                                           \
+      exit(EXIT_FAILURE);                                                      \
+    list->head = reserved;                                                     \
+    list->used = units;                                                        \
+    list->capacity = units;                                                    \
+    for (i = 0; i < JRSL_MAX_LEVEL; ++i)                                       \
+      list->free[i] = 0;                                                       \
+    jrsl_rng_init(&list->rng, p, 0);                                           \
+    head = name##_at(list, list->head);                                        \
+    head->level = max_level;                                                   \
+    head->data = NULL;                                                         \
+    for (i = 0; i < max_level; ++i) {                                          \
+      head->forward[i].node = 0;                                               \
+      head->forward[i].width = 0;                                              \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_initialize(name##_t *list, float p,                  \
+                                     unsigned short max_level) {               \
+    name##_init_pool(list, p, max_level, -1, 1);                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_seed(name##_t *list, unsigned long seed) {           \
+    jrsl_rng_init(&list->rng, list->p, seed);                                  \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC size_t name##_memory(name##_t *list) {                           \
+    return (size_t)list->capacity * JRSL_COMPACT_UNIT;                         \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void name##_destroy(name##_t *list, name##_visitor_t visitor) {  \
+    jrsl_u32_t x = name##_at(list, list->head)->forward[0].node;               \
+    if (visitor) {                                                             \
+      while (x) {                                                              \
+        name##_node_t *node = name##_at(list, x);                              \
+        visitor(node->key, node->data);                                        \
+        x = node->forward[0].node;                                             \
+      }                                                                        \
+    }                                                                          \
+    jrsl_pool_release(list->pool, (size_t)list->capacity * JRSL_COMPACT_UNIT,  \
+                      list->fd);                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_search(name##_t *list, key_type key) {              \
+    size_t i;                                                                  \
+    jrsl_u32_t x = list->head;                                                 \
+    jrsl_u32_t next;                                                           \
+    for (i = list->level; i > 0; --i) {                                        \
+      while ((next = name##_at(list, x)->forward[i - 1].node) != 0 &&          \
+             cmp(name##_at(list, next)->key, key) < 0)                         \
+        x = next;                                                              \
+    }                                                                          \
+    x = name##_at(list, x)->forward[0].node;                                   \
+    if (x && cmp(name##_at(list, x)->key, key) == 0)                           \
+      return name##_at(list, x)->data;                                         \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_insert(name##_t *list, key_type key, void *data) {  \
+    size_t i;                                                                  \
+    jrsl_u32_t x = list->head;                                                 \
+    jrsl_u32_t next;                                                           \
+    size_t rank = 0;                                                           \
+    unsigned short level;                                                      \
+    jrsl_u32_t update[JRSL_MAX_LEVEL];                                         \
+    size_t update_rank[JRSL_MAX_LEVEL];                                        \
+    jrsl_u32_t new_index;                                                      \
+    name##_node_t *new_node;                                                   \
+                                                                               \
+    for (i = list->level; i > 0; --i) {                                        \
+      while ((next = name##_at(list, x)->forward[i - 1].node) != 0 &&          \
+             cmp(name##_at(list, next)->key, key) < 0) {                       \
+        rank += name##_at(list, x)->forward[i - 1].width;                      \
+        x = next;                                                              \
+      }                                                                        \
+      update[i - 1] = x;                                                       \
+      update_rank[i - 1] = rank;                                               \
+    }                                                                          \
+                                                                               \
+    x = name##_at(list, x)->forward[0].node;                                   \
+    if (x && cmp(name##_at(list, x)->key, key) == 0) {                         \
+      void *old = name##_at(list, x)->data;                                    \
+      name##_at(list, x)->data = data;                                         \
+      return old;                                                              \
+    }                                                                          \
+                                                                               \
+    assert(list->width < 0xFFFFFFFFUL);                                        \
+    level = jrsl_draw_level(&list->rng, list->max_level);                      \
+    assert(level < list->max_level);                                           \
+    if (level > list->level) {                                                 \
+      for (i = list->level; i < level; ++i) {                                  \
+        update[i] = list->head;                                                \
+        update_rank[i] = 0;                                                    \
+      }                                                                        \
+      list->level = level;                                                     \
+    }                                                                          \
+                                                                               \
+    /* Allocating may move the pool, no node pointer is held across it */      \
+    new_index = name##_alloc_node(list, level);                                \
+    new_node = name##_at(list, new_index);                                     \
+    new_node->key = key;                                                       \
+    new_node->data = data;                                                     \
+                                                                               \
+    rank = update_rank[0] + 1;                                                 \
+    for (i = 0; i < level; ++i) {                                              \
+      struct name##_link *link = &name##_at(list, update[i])->forward[i];      \
+      new_node->forward[i].node = link->node;                                  \
+      new_node->forward[i].width =                                             \
+          link->node ? (jrsl_u32_t)(update_rank[i] + link->width + 1 - rank)   \
+                     : 0;                                                      \
+      link->node = new_index;                                                  \
+      link->width = (jrsl_u32_t)(rank - update_rank[i]);                       \
+    }                                                                          \
+    for (i = level; i < list->level; ++i) {                                    \
+      struct name##_link *link = &name##_at(list, update[i])->forward[i];      \
+      if (!link->node)                                                         \
+        break;                                                                 \
+      ++link->width;                                                           \
+    }                                                                          \
+                                                                               \
+    list->width++;                                                             \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_remove(name##_t *list, key_type key) {              \
+    size_t i;                                                                  \
+    jrsl_u32_t x = list->head;                                                 \
+    jrsl_u32_t next;                                                           \
+    jrsl_u32_t update[JRSL_MAX_LEVEL];                                         \
+    name##_node_t *node;                                                       \
+    void *old;                                                                 \
+                                                                               \
+    for (i = list->level; i > 0; --i) {                                        \
+      while ((next = name##_at(list, x)->forward[i - 1].node) != 0 &&          \
+             cmp(name##_at(list, next)->key, key) < 0)                         \
+        x = next;                                                              \
+      update[i - 1] = x;                                                       \
+    }                                                                          \
+    x = name##_at(list, x)->forward[0].node;                                   \
+    if (!x || cmp(name##_at(list, x)->key, key) != 0)                          \
+      return NULL;                                                             \
+                                                                               \
+    node = name##_at(list, x);                                                 \
+    for (i = 0; i < list->level; ++i) {                                        \
+      struct name##_link *link = &name##_at(list, update[i])->forward[i];      \
+      if (link->node == x) {                                                   \
+        link->node = node->forward[i].node;                                    \
+        if (node->forward[i].node)                                             \
+          link->width += node->forward[i].width - 1;                           \
+        else                                                                   \
+          link->width = 0;                                                     \
+      } else if (link->node) {                                                 \
+        --link->width;                                                         \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    old = node->data;                                                          \
+    name##_free_node(list, x);                                                 \
+    list->width--;                                                             \
+                                                                               \
+    while (list->level > 1 &&                                                  \
+           !name##_at(list, list->head)->forward[list->level - 1].node)        \
+      --list->level;                                                           \
+    return old;                                                                \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC name##_node_t *name##_node_at(name##_t *list, size_t index) {    \
+    size_t i;                                                                  \
+    size_t w = index + 1;                                                      \
+    jrsl_u32_t x = list->head;                                                 \
+    if (index >= list->width)                                                  \
+      return NULL;                                                             \
+    for (i = list->level; i > 0; --i) {                                        \
+      struct name##_link *link;                                                \
+      while ((link = &name##_at(list, x)->forward[i - 1])->node &&             \
+             link->width <= w) {                                               \
+        w -= link->width;                                                      \
+        x = link->node;                                                        \
+        if (w == 0)                                                            \
+          return name##_at(list, x);                                           \
+      }                                                                        \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC key_type *name##_key_at(name##_t *list, size_t index) {          \
+    name##_node_t *node = name##_node_at(list, index);                         \
+    if (node)                                                                  \
+      return &node->key;                                                       \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC void *name##_data_at(name##_t *list, size_t index) {             \
+    name##_node_t *node = name##_node_at(list, index);                         \
+    if (node)                                                                  \
+      return node->data;                                                       \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC size_t name##_rank(name##_t *list, key_type key) {               \
+    size_t i;                                                                  \
+    size_t rank = 0;                                                           \
+    jrsl_u32_t x = list->head;                                                 \
+    jrsl_u32_t next;                                                           \
+    for (i = list->level; i > 0; --i) {                                        \
+      while ((next = name##_at(list, x)->forward[i - 1].node) != 0 &&          \
+             cmp(name##_at(list, next)->key, key) < 0) {                       \
+        rank += name##_at(list, x)->forward[i - 1].width;                      \
+        x = next;                                                              \
+      }                                                                        \
+    }                                                                          \
+    return rank;                                                               \
+  }
 
-  /* The remaining width to travel. `index` is incremented by 1 because of the
-   * presence of a head in the skip list. */
-  w = index + 1;
+#ifdef JRSL_MMAP
+/* ============================= MAPPED SKIP LISTS ============================
+ * `JRSL_DEFINE_MAPPED(name, key_type, cmp)` generates a compact skip list (see
+ * above) which can also keep its pool in a file mapped with `mmap`. Since the
+ * links are indices in the pool, the file can be mapped anywhere:
+ *
+ *    JRSL_DEFINE_MAPPED(index, jrsl_u64_t, JRSL_CMP_NUMBER)
+ *
+ *    index_t list;
+ *    if (index_open(&list, "index.jrsl", 0.5f, 24) != 0)
+ *      perror("index.jrsl");
+ *    index_search(&list, 42);
+ *    index_sync(&list);
+ *    index_close(&list);
+ *
+ * `name_open` creates the file if it is empty, using `p` and `max_level`, and
+ * otherwise maps it in O(1) (`p` and `max_level` are then the ones of the
+ * file): pages are only read when they are first used. It returns 0, or -1
+ * with `errno` set if the file can't be opened or was not written by the same
+ * list type. `name_sync` writes the state of the list to the file and flushes
+ * it with `msync`, and `name_close` syncs and unmaps it (`name_destroy` unmaps
+ * it without syncing).
+ *
+ * The file is only consistent after `name_sync`: a crash between two syncs may
+ * leave it corrupt. Keys are stored as they are, so they must not be pointers,
+ * and the data of a node is best used as a pointer sized integer (an offset in
+ * another file, ...). The file format depends on the target.
+ */
 
-  x = skip_list->head;
+#define JRSL_POOL_MAGIC "jrslpool"
 
-  for (i = skip_list->level - 1; i >= 0; i--) {
-    while (x->forward[i].node && x->forward[i].width <= w) {
-      w -= x->forward[i].width;
-      x = x->forward[i].node;
-      if (w == 0)
-        return x;
-    }
+/* Written at the start of the file, before the list itself */
+typedef struct jrsl_pool_header_t {
+  char magic[8];
+  jrsl_u32_t unit;
+  jrsl_u32_t list_size;
+  jrsl_u32_t node_size;
+  jrsl_u32_t key_size;
+} jrsl_pool_header_t;
+
+/* Opens (or creates) the file `path` and stores its size in `size`. Returns
+ * its descriptor, or -1. */
+JRSL_STATIC int jrsl_pool_open(const char *path, size_t *size) {
+  struct stat st;
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
   }
-  /* This should never be called beacuse of the initial check.*/
-  return NULL;
+  *size = (size_t)st.st_size;
+  return fd;
 }
 
-/* Returns the key of the `index`th element of the skip list.*/
-void *jrsl_key_at(skip_list_t *skip_list, size_t index) {
-  skip_node_t *node = jrsl_node_at(skip_list, index);
-  if (node)
-    return node->key;
-  return NULL;
+JRSL_STATIC int jrsl_pool_sync(unsigned char *pool, size_t size) {
+  return msync(pool, size, MS_SYNC);
 }
 
-/* Returns the data of the `index`th element of the skip list.*/
-void *jrsl_data_at(skip_list_t *skip_list, size_t index) {
-  skip_node_t *node = jrsl_node_at(skip_list, index);
-  if (node)
-    return node->data;
-  return NULL;
-}
+#define JRSL_DEFINE_MAPPED(name, key_type, cmp)                                \
+  JRSL_DEFINE_COMPACT(name, key_type, cmp)                                     \
+                                                                               \
+  JRSL_STATIC jrsl_u32_t name##_reserved(void) {                               \
+    return (jrsl_u32_t)((sizeof(jrsl_pool_header_t) + sizeof(name##_t) +       \
+                         JRSL_COMPACT_UNIT - 1) /                              \
+                        JRSL_COMPACT_UNIT);                                    \
+  }                                                                            \
+  JRSL_STATIC void name##_header(jrsl_pool_header_t *header) {                 \
+    memset(header, 0, sizeof(*header));                                        \
+    memcpy(header->magic, JRSL_POOL_MAGIC, sizeof(header->magic));             \
+    header->unit = JRSL_COMPACT_UNIT;                                          \
+    header->list_size = (jrsl_u32_t)sizeof(name##_t);                          \
+    header->node_size = (jrsl_u32_t)offsetof(name##_node_t, forward);          \
+    header->key_size = (jrsl_u32_t)sizeof(key_type);                           \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC int name##_open(name##_t *list, const char *path, float p,       \
+                              unsigned short max_level) {                      \
+    size_t size;                                                               \
+    unsigned char *pool;                                                       \
+    jrsl_pool_header_t header;                                                 \
+    int fd = jrsl_pool_open(path, &size);                                      \
+    if (fd < 0)                                                                \
+      return -1;                                                               \
+    if (size == 0) {                                                           \
+      name##_init_pool(list, p, max_level, fd, name##_reserved());             \
+      return 0;                                                                \
+    }                                                                          \
+    if (size < name##_reserved() * (size_t)JRSL_COMPACT_UNIT) {                \
+      jrsl_pool_release(NULL, 0, fd);                                          \
+      errno = EINVAL;                                                          \
+      return -1;                                                               \
+    }                                                                          \
+    pool = jrsl_pool_resize(NULL, 0, size, fd);                                \
+    if (!pool) {                                                               \
+      int error = errno;                                                       \
+      jrsl_pool_release(NULL, 0, fd);                                          \
+      errno = error;                                                           \
+      return -1;                                                               \
+    }                                                                          \
+    name##_header(&header);                                                    \
+    if (memcmp(pool, &header, sizeof(header)) != 0) {                          \
+      jrsl_pool_release(pool, size, fd);                                       \
+      errno = EINVAL;                                                          \
+      return -1;                                                               \
+    }                                                                          \
+    memcpy(list, pool + sizeof(header), sizeof(name##_t));                     \
+    list->pool = pool;                                                         \
+    list->fd = fd;                                                             \
+    list->capacity = (jrsl_u32_t)(size / JRSL_COMPACT_UNIT);                   \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC int name##_sync(name##_t *list) {                                \
+    assert(list->fd >= 0);                                                     \
+    name##_header((jrsl_pool_header_t *)list->pool);                           \
+    memcpy(list->pool + sizeof(jrsl_pool_header_t), list, sizeof(name##_t));   \
+    return jrsl_pool_sync(list->pool,                                          \
+                          (size_t)list->capacity * JRSL_COMPACT_UNIT);         \
+  }                                                                            \
+                                                                               \
+  JRSL_STATIC int name##_close(name##_t *list) {                               \
+    int result = name##_sync(list);                                            \
+    name##_destroy(list, NULL);                                                \
+    return result;                                                             \
+  }
+#endif /*JRSL_MMAP*/
 
-/* Returns the data of the node with the key `key`. If `key` is not in
- * the skip list returns NULL.
+/* =========================== CONCURRENT SKIP LISTS ==========================
+ * Defining `JRSL_CONCURRENT` adds `jrsl_cc_list_t`, a lock-free skip list that
+ * can be shared by any number of threads (Herlihy & Shavit, "The Art of
+ * Multiprocessor Programming", chapter 14, after Fraser).
+ *
+ * Links are swapped with compare-and-swap, and a node is removed by marking
+ * the lowest bit of its own links before unlinking it. Searches never retry
+ * nor write to the list, inserts and removes only retry from the level where
+ * they lost a race. Removed nodes are freed once no thread can hold them
+ * anymore, using epoch based reclamation.
+ *
+ * Keeping widths up to date would serialize every update, so these lists have
+ * no widths and no random access.
+ *
+ * Every thread using a list must register a `jrsl_cc_thread_t` of its own with
+ * `jrsl_cc_register` first, and pass it to every operation. The record must
+ * stay valid until the thread gives it back with `jrsl_cc_unregister`, or
+ * until `jrsl_cc_destroy`. `jrsl_cc_initialize` and `jrsl_cc_destroy` must not
+ * run concurrently with anything else.
+ *
+ * This needs the GNU `__atomic` builtins (GCC 4.7+, Clang).
  */
-void *jrsl_search(skip_list_t *skip_list, void *key) {
-  size_t i;
-  skip_node_t *x;
-  x = skip_list->head;
+#ifdef JRSL_CONCURRENT
 
-  for (i = skip_list->level; i > 0; --i) {
-    while (x->forward[i - 1].node != NULL &&
-           skip_list->comparator(x->forward[i - 1].node->key, key) < 0) {
-      x = x->forward[i - 1].node;
-    }
-  }
-  x = x->forward[0].node;
+#if !defined(__GNUC__)
+#error "JRSL_CONCURRENT needs the GNU __atomic builtins"
+#endif
 
-  if (x)
-    if (skip_list->comparator(x->key, key) == 0) {
-      return x->data;
-    }
+typedef struct jrsl_cc_node_t {
+  void *key;
+  /* Swapped atomically, a removed node holds a sentinel */
+  void *data;
 
-  return NULL;
+  /* Length of the `forward` array */
+  unsigned short level;
+
+  /* The inserter and the remover both hold a reference, the last one to let
+   * go retires the node. */
+  int refs;
+  /* Next retired node, while waiting to be freed */
+  struct jrsl_cc_node_t *retired;
+
+  /* The links to the next nodes, the lowest bit of `forward[i]` is set once the
+   * node is being removed. Allocated inline like `skip_node_t`. */
+  struct jrsl_cc_node_t *forward[1];
+} jrsl_cc_node_t;
+
+/* Size in bytes of a concurrent node holding `level` links. */
+#define JRSL_CC_NODE_SIZE(level)                                               \
+  (offsetof(jrsl_cc_node_t, forward) + (level) * sizeof(jrsl_cc_node_t *))
+
+/* The state of a thread using a concurrent skip list. */
+typedef struct jrsl_cc_thread_t {
+  /* `(epoch << 1) | 1` while the thread is inside an operation, 0 otherwise */
+  unsigned long state;
+  struct jrsl_cc_thread_t *next;
+
+  /* Nodes retired by this thread, by epoch modulo 3 */
+  jrsl_cc_node_t *retired[3];
+  unsigned long retired_epoch[3];
+  size_t retired_count;
+
+  jrsl_rng_t rng;
+} jrsl_cc_thread_t;
+
+typedef struct jrsl_cc_list_t {
+  /* Maximum level for this skip list, at most `JRSL_MAX_LEVEL` */
+  unsigned short max_level;
+  float p;
+
+  /* Highest level in use, only a hint for searches */
+  unsigned short level;
+
+  jrsl_cc_node_t *head;
+
+  comparator_t comparator;
+  /* Called on the keys of removed nodes once they're freed */
+  key_destructor_t key_destructor;
+
+  /* Global epoch, and the registered threads */
+  unsigned long epoch;
+  jrsl_cc_thread_t *threads;
+  unsigned long thread_count;
+  /* Held while walking `threads` or unlinking a record from it */
+  int lock;
+  /* Nodes retired by unregistered threads, by epoch modulo 3 */
+  jrsl_cc_node_t *orphans[3];
+  unsigned long orphan_epoch[3];
+} jrsl_cc_list_t;
+
+void jrsl_cc_initialize(jrsl_cc_list_t *list, comparator_t comparator,
+                        key_destructor_t key_destructor, float p,
+                        unsigned short max_level);
+void jrsl_cc_destroy(jrsl_cc_list_t *list, node_visitor_t node_visitor);
+void jrsl_cc_register(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread);
+void jrsl_cc_unregister(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread);
+
+void *jrsl_cc_search(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread,
+                     void *key);
+void *jrsl_cc_insert(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread, void *key,
+                     void *data);
+void *jrsl_cc_remove(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread,
+                     void *key);
+
+#endif /*JRSL_CONCURRENT*/
+
+#ifdef __cplusplus
 }
+#endif
 
-/* Inserts a new element in the skip list and returns NULL. If an element with
- * that key is already in the list, updates that element and returns the
- * previous data. */
-void *jrsl_insert(skip_list_t *skip_list, void *key, void *data) {
+/* ============================== C++ SKIP LISTS ==============================
+ * Included from C++, this header also defines
+ * `jrsl::skip_list<Key, T, Compare, Alloc>`, an ordered map with the interface
+ * of `std::map` whose pairs are stored inline in the nodes, before their
+ * links. It needs C++11 but not `JRSL_IMPLEMENTATION`:
+ *
+ *    jrsl::skip_list<std::string, int> list;
+ *    list.emplace("answer", 42);
+ *    list.lower_bound("a")->second;
+ *    list[0].first;
+ *
+ * Iterators are bidirectional and stay valid until their element is erased,
+ * even when the list is moved or swapped. Unlike `std::map`, `operator[]` takes
+ * a rank and walks the widths in O(log n) like `nth`, and `rank` returns the
+ * number of keys before a key: use `try_emplace` or `insert_or_assign` to
+ * insert by key. Values only need to be movable, or can be built in place by
+ * `emplace` and `try_emplace`.
+ *
+ * The head is allocated with the nodes, so moves and swaps only exchange
+ * pointers and do not throw. A list that was moved from has no head until its
+ * next insertion.
+ *
+ * Nodes are allocated with `Alloc` rebound to raw storage and the pairs are
+ * constructed through `std::allocator_traits`, so a
+ * `std::pmr::polymorphic_allocator` also hands its memory resource to the keys
+ * and values that take one. Since C++17 `jrsl::pmr::skip_list` is the alias
+ * using it. Define `JRSL_NO_CXX` to leave this part out.
+ */
+
+#if defined(__cplusplus) && !defined(JRSL_NO_CXX) &&                          \
+    (__cplusplus >= 201103L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201103L))
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define JRSL_CXX_PMR
+#endif
+#endif
+
+namespace jrsl {
+
+template <class Key, class T, class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, T> > >
+class skip_list {
+public:
+  typedef Key key_type;
+  typedef T mapped_type;
+  typedef std::pair<const Key, T> value_type;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef Compare key_compare;
+  typedef Alloc allocator_type;
+  typedef value_type &reference;
+  typedef const value_type &const_reference;
+  typedef value_type *pointer;
+  typedef const value_type *const_pointer;
+
+private:
+  struct node;
+  struct link {
+    size_type width;
+    node *next;
+  };
+  /* The pair lives `value_offset()` bytes before the node. Every level is a
+   * ring through the head: the last link of a level leads back to the head
+   * with a width of 0, `backward` of the first node is the head, and the
+   * head's one is the last node. */
+  struct node {
+    node *backward;
+    unsigned short level;
+    link forward[1];
+  };
+
+  /* Allocation unit, aligned for both the pair and the node */
+  static const std::size_t unit_align = alignof(value_type) > alignof(node)
+                                            ? alignof(value_type)
+                                            : alignof(node);
+  struct alignas(unit_align) unit {
+    unsigned char bytes[unit_align];
+  };
+
+  typedef std::allocator_traits<Alloc> alloc_traits;
+  typedef typename alloc_traits::template rebind_alloc<unit> node_alloc;
+  typedef std::allocator_traits<node_alloc> node_traits;
+  typedef typename alloc_traits::template rebind_alloc<value_type> value_alloc;
+  typedef std::allocator_traits<value_alloc> value_traits;
+  typedef typename node_traits::propagate_on_container_copy_assignment
+      propagate_copy;
+  typedef typename node_traits::propagate_on_container_move_assignment
+      propagate_move;
+  typedef typename node_traits::propagate_on_container_swap propagate_swap;
+#if __cplusplus >= 201703L
+  typedef typename node_traits::is_always_equal always_equal;
+#else
+  typedef typename std::is_empty<node_alloc>::type always_equal;
+#endif
+
+  static std::size_t value_offset() {
+    return (sizeof(value_type) + alignof(node) - 1) / alignof(node) *
+           alignof(node);
+  }
+  static std::size_t units(unsigned short level) {
+    return (value_offset() + sizeof(node) + (level - 1) * sizeof(link) +
+            unit_align - 1) /
+           unit_align;
+  }
+  /* The head has no pair */
+  static std::size_t head_units() {
+    std::size_t size = sizeof(node) + (JRSL_MAX_LEVEL - 1) * sizeof(link);
+    return (size + unit_align - 1) / unit_align;
+  }
+  static value_type *value_of(node *x) {
+    return reinterpret_cast<value_type *>(reinterpret_cast<unsigned char *>(x) -
+                                          value_offset());
+  }
+  static const Key &key_of(node *x) { return value_of(x)->first; }
+
+  template <bool Const> class basic_iterator {
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef std::pair<const Key, T> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef typename std::conditional<Const, const value_type &,
+                                      value_type &>::type reference;
+    typedef typename std::conditional<Const, const value_type *,
+                                      value_type *>::type pointer;
+
+    basic_iterator() : x_(nullptr) {}
+    basic_iterator(const basic_iterator<false> &it) : x_(it.x_) {}
+
+    reference operator*() const { return *value_of(x_); }
+    pointer operator->() const { return value_of(x_); }
+
+    basic_iterator &operator++() {
+      x_ = x_->forward[0].next;
+      return *this;
+    }
+    basic_iterator operator++(int) {
+      basic_iterator it = *this;
+      ++*this;
+      return it;
+    }
+    basic_iterator &operator--() {
+      x_ = x_->backward;
+      return *this;
+    }
+    basic_iterator operator--(int) {
+      basic_iterator it = *this;
+      --*this;
+      return it;
+    }
+
+    template <bool C> bool operator==(const basic_iterator<C> &it) const {
+      return x_ == it.x_;
+    }
+    template <bool C> bool operator!=(const basic_iterator<C> &it) const {
+      return x_ != it.x_;
+    }
+
+  private:
+    friend class skip_list;
+    friend class basic_iterator<!Const>;
+    explicit basic_iterator(node *x) : x_(x) {}
+
+    node *x_;
+  };
+
+public:
+  typedef basic_iterator<false> iterator;
+  typedef basic_iterator<true> const_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  skip_list() { init(0.5f); }
+  explicit skip_list(const Compare &comp, const Alloc &alloc = Alloc())
+      : alloc_(alloc), comp_(comp) {
+    init(0.5f);
+  }
+  explicit skip_list(const Alloc &alloc) : alloc_(alloc) { init(0.5f); }
+  /* `p` is the probability for a node to reach the next level */
+  explicit skip_list(float p, const Compare &comp = Compare(),
+                     const Alloc &alloc = Alloc())
+      : alloc_(alloc), comp_(comp) {
+    init(p);
+  }
+  template <class InputIt>
+  skip_list(InputIt first, InputIt last, const Compare &comp = Compare(),
+            const Alloc &alloc = Alloc())
+      : alloc_(alloc), comp_(comp) {
+    init(0.5f);
+    guard(first, last, false);
+  }
+  skip_list(std::initializer_list<value_type> values,
+            const Compare &comp = Compare(), const Alloc &alloc = Alloc())
+      : alloc_(alloc), comp_(comp) {
+    init(0.5f);
+    guard(values.begin(), values.end(), false);
+  }
+
+  skip_list(const skip_list &other)
+      : alloc_(node_traits::select_on_container_copy_construction(
+            other.alloc_)),
+        comp_(other.comp_) {
+    init(other.p_);
+    guard(other.begin(), other.end(), true);
+  }
+  skip_list(const skip_list &other, const Alloc &alloc)
+      : alloc_(alloc), comp_(other.comp_) {
+    init(other.p_);
+    guard(other.begin(), other.end(), true);
+  }
+  skip_list(skip_list &&other) noexcept(
+      std::is_nothrow_copy_constructible<Compare>::value)
+      : head_(nullptr), size_(0), rng_(other.rng_), p_(other.p_), level_(1),
+        alloc_(std::move(other.alloc_)), comp_(other.comp_) {
+    steal(other);
+  }
+  skip_list(skip_list &&other, const Alloc &alloc)
+      : head_(nullptr), size_(0), rng_(other.rng_), p_(other.p_), level_(1),
+        alloc_(alloc), comp_(other.comp_) {
+    if (alloc_ == other.alloc_) {
+      steal(other);
+    } else {
+      make_head();
+      guard(std::make_move_iterator(other.begin()),
+            std::make_move_iterator(other.end()), true);
+      other.clear();
+    }
+  }
+
+  ~skip_list() {
+    clear();
+    free_head();
+  }
+
+  skip_list &operator=(const skip_list &other) {
+    if (this != &other) {
+      clear();
+      if (propagate_copy::value && !(alloc_ == other.alloc_))
+        free_head();
+      assign_alloc(other.alloc_,
+                   std::integral_constant<bool, propagate_copy::value>());
+      comp_ = other.comp_;
+      p_ = other.p_;
+      jrsl_rng_init(&rng_, p_, 0);
+      make_head();
+      append(other.begin(), other.end());
+    }
+    return *this;
+  }
+  skip_list &operator=(skip_list &&other) noexcept(
+      (propagate_move::value || always_equal::value) &&
+      std::is_nothrow_copy_assignable<Compare>::value) {
+    if (this != &other) {
+      const bool propagate = propagate_move::value;
+      clear();
+      comp_ = other.comp_;
+      p_ = other.p_;
+      rng_ = other.rng_;
+      if (propagate || alloc_ == other.alloc_) {
+        free_head();
+        assign_alloc(other.alloc_,
+                     std::integral_constant<bool, propagate>());
+        steal(other);
+      } else {
+        make_head();
+        append(std::make_move_iterator(other.begin()),
+               std::make_move_iterator(other.end()));
+        other.clear();
+      }
+    }
+    return *this;
+  }
+  skip_list &operator=(std::initializer_list<value_type> values) {
+    clear();
+    insert(values.begin(), values.end());
+    return *this;
+  }
+
+  allocator_type get_allocator() const { return allocator_type(alloc_); }
+  key_compare key_comp() const { return comp_; }
+
+  /* Reseeds the level generator, for reproducible shapes */
+  void seed(unsigned long seed) { jrsl_rng_init(&rng_, p_, seed); }
+
+  iterator begin() { return iterator(first()); }
+  const_iterator begin() const { return const_iterator(first()); }
+  const_iterator cbegin() const { return begin(); }
+  iterator end() { return iterator(head_); }
+  const_iterator end() const { return const_iterator(head_); }
+  const_iterator cend() const { return end(); }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  const_reverse_iterator rbegin() const {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator crbegin() const { return rbegin(); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rend() const {
+    return const_reverse_iterator(begin());
+  }
+  const_reverse_iterator crend() const { return rend(); }
+
+  bool empty() const { return size_ == 0; }
+  size_type size() const { return size_; }
+  size_type max_size() const {
+    return node_traits::max_size(alloc_) / units(JRSL_MAX_LEVEL);
+  }
+
+  /* Element of rank `rank`, which must be smaller than `size()` */
+  reference operator[](size_type rank) { return *value_of(node_at(rank)); }
+  const_reference operator[](size_type rank) const {
+    return *value_of(node_at(rank));
+  }
+  /* Iterator to the element of rank `rank`, or `end()` */
+  iterator nth(size_type rank) {
+    return rank < size_ ? iterator(node_at(rank)) : end();
+  }
+  const_iterator nth(size_type rank) const {
+    return rank < size_ ? const_iterator(node_at(rank)) : end();
+  }
+  /* Number of keys strictly smaller than `key` */
+  size_type rank(const Key &key) const {
+    node *x = head_;
+    size_type rank = 0;
+    unsigned short i;
+    if (!size_)
+      return 0;
+    for (i = level_; i > 0; --i) {
+      while (x->forward[i - 1].next != head_ &&
+             comp_(key_of(x->forward[i - 1].next), key)) {
+        rank += x->forward[i - 1].width;
+        x = x->forward[i - 1].next;
+      }
+    }
+    return rank;
+  }
+
+  T &at(const Key &key) {
+    iterator it = find(key);
+    if (it == end())
+      throw std::out_of_range("jrsl::skip_list::at");
+    return it->second;
+  }
+  const T &at(const Key &key) const {
+    const_iterator it = find(key);
+    if (it == end())
+      throw std::out_of_range("jrsl::skip_list::at");
+    return it->second;
+  }
+
+  iterator find(const Key &key) { return iterator(find_node(key)); }
+  const_iterator find(const Key &key) const {
+    return const_iterator(find_node(key));
+  }
+  size_type count(const Key &key) const {
+    return find_node(key) != head_ ? 1 : 0;
+  }
+  bool contains(const Key &key) const { return find_node(key) != head_; }
+  iterator lower_bound(const Key &key) { return iterator(bound(key, false)); }
+  const_iterator lower_bound(const Key &key) const {
+    return const_iterator(bound(key, false));
+  }
+  iterator upper_bound(const Key &key) { return iterator(bound(key, true)); }
+  const_iterator upper_bound(const Key &key) const {
+    return const_iterator(bound(key, true));
+  }
+  std::pair<iterator, iterator> equal_range(const Key &key) {
+    return std::make_pair(lower_bound(key), upper_bound(key));
+  }
+  std::pair<const_iterator, const_iterator>
+  equal_range(const Key &key) const {
+    return std::make_pair(lower_bound(key), upper_bound(key));
+  }
+
+  /* The pair is built before the search, and destroyed if its key is already
+   * in the list */
+  template <class... Args> std::pair<iterator, bool> emplace(Args &&...args) {
+    node *update[JRSL_MAX_LEVEL];
+    size_type update_rank[JRSL_MAX_LEVEL];
+    node *x, *y;
+
+    make_head();
+    x = create(jrsl_draw_level(&rng_, JRSL_MAX_LEVEL),
+               std::forward<Args>(args)...);
+    path(key_of(x), update, update_rank);
+    y = update[0]->forward[0].next;
+    if (y != head_ && !comp_(key_of(x), key_of(y))) {
+      destroy(x);
+      return std::make_pair(iterator(y), false);
+    }
+    link_node(x, update, update_rank);
+    return std::make_pair(iterator(x), true);
+  }
+  template <class... Args>
+  iterator emplace_hint(const_iterator, Args &&...args) {
+    return emplace(std::forward<Args>(args)...).first;
+  }
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const Key &key, Args &&...args) {
+    return insert_unique(key, std::piecewise_construct,
+                         std::forward_as_tuple(key),
+                         std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(Key &&key, Args &&...args) {
+    return insert_unique(key, std::piecewise_construct,
+                         std::forward_as_tuple(std::move(key)),
+                         std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign(const Key &key, M &&obj) {
+    std::pair<iterator, bool> result = try_emplace(key, std::forward<M>(obj));
+    if (!result.second)
+      result.first->second = std::forward<M>(obj);
+    return result;
+  }
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign(Key &&key, M &&obj) {
+    std::pair<iterator, bool> result =
+        try_emplace(std::move(key), std::forward<M>(obj));
+    if (!result.second)
+      result.first->second = std::forward<M>(obj);
+    return result;
+  }
+
+  std::pair<iterator, bool> insert(const value_type &value) {
+    return insert_unique(value.first, value);
+  }
+  std::pair<iterator, bool> insert(value_type &&value) {
+    return insert_unique(value.first, std::move(value));
+  }
+  template <class P, class = typename std::enable_if<
+                         std::is_constructible<value_type, P &&>::value>::type>
+  std::pair<iterator, bool> insert(P &&value) {
+    return emplace(std::forward<P>(value));
+  }
+  iterator insert(const_iterator, const value_type &value) {
+    return insert(value).first;
+  }
+  iterator insert(const_iterator, value_type &&value) {
+    return insert(std::move(value)).first;
+  }
+  template <class InputIt> void insert(InputIt first, InputIt last) {
+    for (; first != last; ++first)
+      emplace(*first);
+  }
+  void insert(std::initializer_list<value_type> values) {
+    insert(values.begin(), values.end());
+  }
+
+  iterator erase(const_iterator pos) {
+    node *update[JRSL_MAX_LEVEL];
+    node *next = pos.x_->forward[0].next;
+    path(key_of(pos.x_), update, nullptr);
+    unlink_node(pos.x_, update);
+    return iterator(next);
+  }
+  iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+  iterator erase(const_iterator first, const_iterator last) {
+    while (first != last)
+      first = erase(first);
+    return iterator(last.x_);
+  }
+  size_type erase(const Key &key) {
+    node *update[JRSL_MAX_LEVEL];
+    node *x;
+    if (!size_)
+      return 0;
+    path(key, update, nullptr);
+    x = update[0]->forward[0].next;
+    if (x == head_ || comp_(key, key_of(x)))
+      return 0;
+    unlink_node(x, update);
+    return 1;
+  }
+
+  void clear() {
+    node *x;
+    if (!head_)
+      return;
+    x = head_->forward[0].next;
+    while (x != head_) {
+      node *next = x->forward[0].next;
+      destroy(x);
+      x = next;
+    }
+    reset();
+  }
+
+  void swap(skip_list &other) noexcept(
+      std::is_nothrow_move_constructible<Compare>::value &&
+      std::is_nothrow_move_assignable<Compare>::value) {
+    swap_alloc(other, std::integral_constant<bool, propagate_swap::value>());
+    std::swap(comp_, other.comp_);
+    std::swap(head_, other.head_);
+    std::swap(level_, other.level_);
+    std::swap(size_, other.size_);
+    std::swap(rng_, other.rng_);
+    std::swap(p_, other.p_);
+  }
+
+private:
+  node *first() const { return head_ ? head_->forward[0].next : nullptr; }
+
+  void init(float p) {
+    p_ = p;
+    jrsl_rng_init(&rng_, p, 0);
+    head_ = nullptr;
+    level_ = 1;
+    size_ = 0;
+    make_head();
+  }
+
+  void make_head() {
+    if (head_)
+      return;
+    head_ =
+        reinterpret_cast<node *>(node_traits::allocate(alloc_, head_units()));
+    head_->level = JRSL_MAX_LEVEL;
+    reset();
+  }
+
+  void free_head() {
+    if (!head_)
+      return;
+    node_traits::deallocate(alloc_, reinterpret_cast<unit *>(head_),
+                            head_units());
+    head_ = nullptr;
+  }
+
+  /* Empties the head, which then only links to itself */
+  void reset() {
+    unsigned short i;
+    for (i = 0; i < JRSL_MAX_LEVEL; ++i) {
+      head_->forward[i].width = 0;
+      head_->forward[i].next = head_;
+    }
+    head_->backward = head_;
+    level_ = 1;
+    size_ = 0;
+  }
+
+  /* Takes the nodes of `other`, whose head must have been freed */
+  void steal(skip_list &other) {
+    head_ = other.head_;
+    level_ = other.level_;
+    size_ = other.size_;
+    other.head_ = nullptr;
+    other.level_ = 1;
+    other.size_ = 0;
+  }
+
+  void assign_alloc(const node_alloc &alloc, std::true_type) {
+    alloc_ = alloc;
+  }
+  void assign_alloc(const node_alloc &, std::false_type) {}
+  void swap_alloc(skip_list &other, std::true_type) {
+    using std::swap;
+    swap(alloc_, other.alloc_);
+  }
+  void swap_alloc(skip_list &, std::false_type) {}
+
+  template <class... Args> node *create(unsigned short level, Args &&...args) {
+    unit *block = node_traits::allocate(alloc_, units(level));
+    node *x = reinterpret_cast<node *>(
+        reinterpret_cast<unsigned char *>(block) + value_offset());
+    value_alloc alloc(alloc_);
+    try {
+      value_traits::construct(alloc, value_of(x), std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(alloc_, block, units(level));
+      throw;
+    }
+    x->level = level;
+    return x;
+  }
+
+  void destroy(node *x) {
+    value_alloc alloc(alloc_);
+    value_traits::destroy(alloc, value_of(x));
+    node_traits::deallocate(alloc_, reinterpret_cast<unit *>(value_of(x)),
+                            units(x->level));
+  }
+
+  /* Fills `update` with the last node before `key` on every level, and
+   * `update_rank` (if not NULL) with their ranks. The list needs a head. */
+  void path(const Key &key, node **update, size_type *update_rank) const {
+    node *x = head_;
+    size_type rank = 0;
+    unsigned short i = level_;
+    do {
+      --i;
+      while (x->forward[i].next != head_ &&
+             comp_(key_of(x->forward[i].next), key)) {
+        rank += x->forward[i].width;
+        x = x->forward[i].next;
+      }
+      update[i] = x;
+      if (update_rank)
+        update_rank[i] = rank;
+    } while (i > 0);
+  }
+
+  /* First node not before `key`, or after it if `upper`, or the head */
+  node *bound(const Key &key, bool upper) const {
+    node *x = head_;
+    unsigned short i;
+    if (!size_)
+      return head_;
+    for (i = level_; i > 0; --i) {
+      node *next;
+      while ((next = x->forward[i - 1].next) != head_ &&
+             (upper ? !comp_(key, key_of(next)) : comp_(key_of(next), key)))
+        x = next;
+    }
+    return x->forward[0].next;
+  }
+
+  /* The node of `key`, or the head */
+  node *find_node(const Key &key) const {
+    node *x = bound(key, false);
+    return x != head_ && !comp_(key, key_of(x)) ? x : head_;
+  }
+
+  node *node_at(size_type rank) const {
+    node *x = head_;
+    size_type w = rank + 1;
+    unsigned short i;
+    assert(rank < size_);
+    for (i = level_; i > 0; --i) {
+      while (x->forward[i - 1].next != head_ &&
+             x->forward[i - 1].width <= w) {
+        w -= x->forward[i - 1].width;
+        x = x->forward[i - 1].next;
+      }
+    }
+    return x;
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> insert_unique(const Key &key, Args &&...args) {
+    node *update[JRSL_MAX_LEVEL];
+    size_type update_rank[JRSL_MAX_LEVEL];
+    node *x;
+
+    make_head();
+    path(key, update, update_rank);
+    x = update[0]->forward[0].next;
+    if (x != head_ && !comp_(key, key_of(x)))
+      return std::make_pair(iterator(x), false);
+    x = create(jrsl_draw_level(&rng_, JRSL_MAX_LEVEL),
+               std::forward<Args>(args)...);
+    link_node(x, update, update_rank);
+    return std::make_pair(iterator(x), true);
+  }
+
+  /* Links `x` after the path found by `path`, like `jrsl_insert` */
+  void link_node(node *x, node **update, size_type *update_rank) {
+    unsigned short level = x->level;
+    size_type rank = update_rank[0] + 1;
+    unsigned short i;
+
+    for (i = level_; i < level; ++i) {
+      update[i] = head_;
+      update_rank[i] = 0;
+    }
+    if (level > level_)
+      level_ = level;
+
+    for (i = 0; i < level; ++i) {
+      link *l = &update[i]->forward[i];
+      x->forward[i].next = l->next;
+      x->forward[i].width =
+          l->next != head_ ? update_rank[i] + l->width + 1 - rank : 0;
+      l->next = x;
+      l->width = rank - update_rank[i];
+    }
+    for (i = level; i < level_; ++i)
+      if (update[i]->forward[i].next != head_)
+        ++update[i]->forward[i].width;
+
+    x->backward = update[0];
+    x->forward[0].next->backward = x;
+    ++size_;
+  }
+
+  void unlink_node(node *x, node **update) {
+    unsigned short i;
+    for (i = 0; i < level_; ++i) {
+      link *l = &update[i]->forward[i];
+      if (l->next == x) {
+        l->next = x->forward[i].next;
+        l->width = l->next != head_ ? l->width + x->forward[i].width - 1 : 0;
+      } else if (l->next != head_) {
+        --l->width;
+      }
+    }
+    x->forward[0].next->backward = x->backward;
+
+    destroy(x);
+    --size_;
+    while (level_ > 1 && head_->forward[level_ - 1].next == head_)
+      --level_;
+  }
+
+  /* Fills an empty list from a sorted range in O(n) */
+  template <class InputIt> void append(InputIt first, InputIt last) {
+    node *update[JRSL_MAX_LEVEL];
+    size_type update_rank[JRSL_MAX_LEVEL];
+    unsigned short i;
+    for (i = 0; i < JRSL_MAX_LEVEL; ++i) {
+      update[i] = head_;
+      update_rank[i] = 0;
+    }
+    for (; first != last; ++first) {
+      node *x = create(jrsl_draw_level(&rng_, JRSL_MAX_LEVEL), *first);
+      link_node(x, update, update_rank);
+      for (i = 0; i < x->level; ++i) {
+        update[i] = x;
+        update_rank[i] = size_;
+      }
+    }
+  }
+
+  /* Fills a list under construction, that the destructor will not clean */
+  template <class InputIt>
+  void guard(InputIt first, InputIt last, bool sorted) {
+    try {
+      if (sorted)
+        append(first, last);
+      else
+        insert(first, last);
+    } catch (...) {
+      clear();
+      free_head();
+      throw;
+    }
+  }
+
+  node *head_;
+  size_type size_;
+  jrsl_rng_t rng_;
+  float p_;
+  unsigned short level_;
+  node_alloc alloc_;
+  Compare comp_;
+};
+
+template <class Key, class T, class Compare, class Alloc>
+bool operator==(const skip_list<Key, T, Compare, Alloc> &a,
+                const skip_list<Key, T, Compare, Alloc> &b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+template <class Key, class T, class Compare, class Alloc>
+bool operator!=(const skip_list<Key, T, Compare, Alloc> &a,
+                const skip_list<Key, T, Compare, Alloc> &b) {
+  return !(a == b);
+}
+template <class Key, class T, class Compare, class Alloc>
+bool operator<(const skip_list<Key, T, Compare, Alloc> &a,
+               const skip_list<Key, T, Compare, Alloc> &b) {
+  return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+}
+
+template <class Key, class T, class Compare, class Alloc>
+void swap(skip_list<Key, T, Compare, Alloc> &a,
+          skip_list<Key, T, Compare, Alloc> &b) noexcept(noexcept(a.swap(b))) {
+  a.swap(b);
+}
+
+#ifdef JRSL_CXX_PMR
+namespace pmr {
+template <class Key, class T, class Compare = std::less<Key> >
+using skip_list =
+    jrsl::skip_list<Key, T, Compare,
+                    std::pmr::polymorphic_allocator<std::pair<const Key, T> > >;
+}
+#endif
+
+} /* namespace jrsl */
+
+#endif /*__cplusplus && !JRSL_NO_CXX*/
+
+#endif /*!JRSL_H*/
+#ifdef JRSL_IMPLEMENTATION
+
+/* Adds `n` to a counter of the list, atomically if readers may run
+ * concurrently */
+#ifdef JRSL_STATS
+#ifdef JRSL_OPTIMISTIC
+#define JRSL_STAT_ADD(skip_list, counter, n)                                   \
+  ((void)__atomic_fetch_add(&(skip_list)->stats.counter, (n), __ATOMIC_RELAXED))
+#else
+#define JRSL_STAT_ADD(skip_list, counter, n)                                   \
+  ((void)((skip_list)->stats.counter += (n)))
+#endif
+#else
+#define JRSL_STAT_ADD(skip_list, counter, n) ((void)0)
+#endif
+/* Calls the comparator of the list, counting the call */
+#define JRSL_CMP(skip_list, a, b)                                              \
+  (JRSL_STAT_ADD(skip_list, comparisons, 1), (skip_list)->comparator((a), (b)))
+
+/* Allocates a node with `level` links using the skip list's allocator. */
+static skip_node_t *jrsl_alloc_node(skip_list_t *skip_list,
+                                    unsigned short level) {
+  skip_node_t *node = (skip_node_t *)skip_list->allocator.alloc(
+      skip_list->allocator.context, JRSL_NODE_SIZE(level), level);
+  if (!node) {
+    /* Allocation failure */
+    exit(EXIT_FAILURE);
+  }
+  node->level = level;
+#ifdef JRSL_SNAPSHOTS
+  node->birth = skip_list->snapshot_version;
+  node->death = 0;
+#endif
+  JRSL_STAT_ADD(skip_list, allocations, 1);
+  return node;
+}
+
+/* Gives a node back to the skip list's allocator. */
+static void jrsl_free_node(skip_list_t *skip_list, skip_node_t *node) {
+  JRSL_STAT_ADD(skip_list, frees, 1);
+  skip_list->allocator.free(skip_list->allocator.context, node,
+                            JRSL_NODE_SIZE(node->level), node->level);
+}
+
+#ifdef JRSL_AGGREGATE
+/* Recomputes the aggregate of the link of `x` on level `i` from the links of
+ * the level below, which must be up to date. */
+static void jrsl_aggregate_link(skip_list_t *skip_list, skip_node_t *x,
+                                size_t i) {
+  jrsl_aggregator_t *aggregator = &skip_list->aggregator;
+  struct link *link = &x->forward[i];
+  JRSL_AGGREGATE value = aggregator->identity;
+
+  if (!aggregator->combine)
+    return;
+  if (link->node && i == 0) {
+    value = aggregator->measure(link->node->key, link->node->data);
+  } else if (link->node) {
+    do {
+      value = aggregator->combine(value, x->forward[i - 1].aggregate);
+      x = x->forward[i - 1].node;
+    } while (x != link->node);
+  }
+  link->aggregate = value;
+}
+
+/* Recomputes the aggregates of the links of `update[i]` on the `level` lowest
+ * levels, from the bottom up. */
+static void jrsl_aggregate_path(skip_list_t *skip_list, skip_node_t **update,
+                                size_t level) {
+  size_t i;
+  for (i = 0; i < level; ++i)
+    jrsl_aggregate_link(skip_list, update[i], i);
+}
+
+#define JRSL_AGGREGATE_LINK(skip_list, x, i)                                   \
+  jrsl_aggregate_link(skip_list, x, i)
+#define JRSL_AGGREGATE_PATH(skip_list, update, level)                          \
+  jrsl_aggregate_path(skip_list, update, level)
+#else
+#define JRSL_AGGREGATE_LINK(skip_list, x, i) ((void)0)
+#define JRSL_AGGREGATE_PATH(skip_list, update, level) ((void)0)
+#endif
+
+#ifdef JRSL_OPTIMISTIC
+/* Waits for the other writers and makes the version odd. */
+static void jrsl_write_begin(skip_list_t *skip_list) {
+  unsigned long version =
+      __atomic_load_n(&skip_list->version, __ATOMIC_RELAXED);
+  for (;;) {
+    if (version & 1)
+      version = __atomic_load_n(&skip_list->version, __ATOMIC_RELAXED);
+    else if (__atomic_compare_exchange_n(&skip_list->version, &version,
+                                         version + 1, 1, __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED))
+      break;
+  }
+  /* The updates can't be seen before the version is odd */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void jrsl_write_end(skip_list_t *skip_list) {
+  __atomic_store_n(&skip_list->version, skip_list->version + 1,
+                   __ATOMIC_RELEASE);
+}
+
+/* Waits for the running writer if any and returns the (even) version. */
+static unsigned long jrsl_read_begin(skip_list_t *skip_list) {
+  unsigned long version;
+  while ((version = __atomic_load_n(&skip_list->version, __ATOMIC_ACQUIRE)) &
+         1)
+    ;
+  return version;
+}
+
+/* Returns whether the list changed since `jrsl_read_begin` returned
+ * `version`, in which case whatever was read must be thrown away. */
+static int jrsl_read_retry(skip_list_t *skip_list, unsigned long version) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&skip_list->version, __ATOMIC_RELAXED) != version;
+}
+
+#define JRSL_WRITE_BEGIN(skip_list) jrsl_write_begin(skip_list)
+#define JRSL_WRITE_END(skip_list) jrsl_write_end(skip_list)
+#define JRSL_READ_BEGIN(skip_list) jrsl_read_begin(skip_list)
+#define JRSL_READ_RETRY(skip_list, version) jrsl_read_retry(skip_list, version)
+/* Links a node which readers may reach right away */
+#define JRSL_PUBLISH(link, node)                                               \
+  __atomic_store_n(&(link), (node), __ATOMIC_RELEASE)
+/* Reads a link once, readers must not read it twice */
+#define JRSL_LOAD(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+#else
+#define JRSL_WRITE_BEGIN(skip_list) ((void)0)
+#define JRSL_WRITE_END(skip_list) ((void)0)
+#define JRSL_READ_BEGIN(skip_list) 0UL
+#define JRSL_READ_RETRY(skip_list, version) ((void)(version), 0)
+#define JRSL_PUBLISH(link, node) ((link) = (node))
+#define JRSL_LOAD(link) (link)
+#endif
+
+#ifdef JRSL_WAL
+#define JRSL_LOG_INSERT 1
+#define JRSL_LOG_REMOVE 2
+/* Number of insertions sorted together by `jrsl_replay` */
+#ifndef JRSL_REPLAY_BATCH
+#define JRSL_REPLAY_BATCH 256
+#endif
+static void jrsl_log_record(jrsl_log_t *log, unsigned char op, void *key,
+                            void *data);
+/* Logs an update of the list if it has a log */
+#define JRSL_LOG(skip_list, op, key, data)                                     \
+  do {                                                                         \
+    if ((skip_list)->log)                                                      \
+      jrsl_log_record((skip_list)->log, (op), (key), (data));                  \
+  } while (0)
+#else
+#define JRSL_LOG(skip_list, op, key, data) ((void)0)
+#endif
+
+/* Frees a removed node, or keeps it for `jrsl_reclaim` if readers may still be
+ * walking it. */
+static void jrsl_retire_node(skip_list_t *skip_list, skip_node_t *node) {
+#ifdef JRSL_OPTIMISTIC
+  node->data = skip_list->retired;
+  skip_list->retired = node;
+#else
+  jrsl_free_node(skip_list, node);
+#endif
+}
+
+#ifdef JRSL_SNAPSHOTS
+/* Returns whether the snapshot of version `version` sees `node`. The death is
+ * read first, see `jrsl_snapshot_sweep`. */
+static int jrsl_snapshot_sees(unsigned long version, skip_node_t *node) {
+  unsigned long death = JRSL_LOAD(node->death);
+  return JRSL_LOAD(node->birth) <= version && (!death || version < death);
+}
+
+/* Returns whether an open snapshot may see the element of `node`. */
+static int jrsl_snapshot_keeps(skip_list_t *skip_list, skip_node_t *node) {
+  return skip_list->newest && skip_list->newest->version >= node->birth;
+}
+
+/* Returns the node before `node` on the snapshot chain, `pred` being a node
+ * before it. */
+static skip_node_t *jrsl_chain_pred(skip_node_t *pred, skip_node_t *node) {
+  while (pred->snapshot_next != node)
+    pred = pred->snapshot_next;
+  return pred;
+}
+
+/* Links `next` after `x` on the snapshot chain */
+#define JRSL_SNAPSHOT_LINK(x, next) JRSL_PUBLISH((x)->snapshot_next, next)
+/* Replaces `node` with a copy before changing it if a snapshot may see it,
+ * `update` being its search path */
+#define JRSL_COPY_ON_WRITE(skip_list, node, update)                            \
+  do {                                                                         \
+    if (jrsl_snapshot_keeps(skip_list, node))                                  \
+      (node) = jrsl_resize_node(skip_list, node, (node)->level, update);       \
+  } while (0)
+/* Functions rebuilding the lowest level don't keep removed nodes around */
+#define JRSL_SNAPSHOT_OPEN(skip_list) ((skip_list)->oldest != NULL)
+#define JRSL_NO_SNAPSHOT(skip_list) assert(!JRSL_SNAPSHOT_OPEN(skip_list))
+#else
+#define JRSL_SNAPSHOT_LINK(x, next) ((void)0)
+#define JRSL_COPY_ON_WRITE(skip_list, node, update) ((void)0)
+#define JRSL_SNAPSHOT_OPEN(skip_list) 0
+#define JRSL_NO_SNAPSHOT(skip_list) ((void)0)
+#endif
+
+/* `jrsl_retire_node` for a node off the snapshot chain, which waits for the
+ * snapshots open now to be closed since they may still be walking it. */
+static void jrsl_snapshot_retire(skip_list_t *skip_list, skip_node_t *node) {
+#ifdef JRSL_SNAPSHOTS
+  if (skip_list->oldest) {
+    JRSL_PUBLISH(node->death, skip_list->snapshot_version);
+    node->snapshot_garbage = skip_list->garbage;
+    skip_list->garbage = node;
+    return;
+  }
+#endif
+  jrsl_retire_node(skip_list, node);
+}
+
+/* Retires `node`, which was just unlinked from the list. An open snapshot
+ * which may see it keeps it on the snapshot chain, otherwise it leaves the
+ * chain, where `pred` is a node before it. Returns the node before the next one
+ * on the chain. */
+static skip_node_t *jrsl_release_node(skip_list_t *skip_list,
+                                      skip_node_t *pred, skip_node_t *node) {
+#ifdef JRSL_SNAPSHOTS
+  if (jrsl_snapshot_keeps(skip_list, node)) {
+    JRSL_PUBLISH(node->death, skip_list->snapshot_version);
+    node->snapshot_garbage = skip_list->dead;
+    skip_list->dead = node;
+    return node;
+  }
+  pred = jrsl_chain_pred(pred, node);
+  JRSL_PUBLISH(pred->snapshot_next, node->snapshot_next);
+  jrsl_snapshot_retire(skip_list, node);
+#else
+  jrsl_retire_node(skip_list, node);
+#endif
+  return pred;
+}
+
+/* A chunk of the slab allocator, the nodes follow the header. */
+struct jrsl_slab_chunk_t {
+  struct jrsl_slab_chunk_t *next;
+  /* Keeps the nodes following the header aligned. */
+  struct link align;
+};
+
+static void *jrsl_slab_alloc(void *context, size_t size,
+                             unsigned short level) {
+  jrsl_slab_t *slab = (jrsl_slab_t *)context;
+  struct jrsl_slab_class_t *size_class;
+  void *node;
+
+  /* Grows the size classes if needed */
+  if (level > slab->class_count) {
+    unsigned short i;
+    struct jrsl_slab_class_t *classes = (struct jrsl_slab_class_t *)realloc(
+        slab->classes, level * sizeof(struct jrsl_slab_class_t));
+    if (!classes)
+      return NULL;
+    for (i = slab->class_count; i < level; ++i) {
+      classes[i].free_list = NULL;
+      classes[i].cursor = NULL;
+      classes[i].end = NULL;
+    }
+    slab->classes = classes;
+    slab->class_count = level;
+  }
+  size_class = &slab->classes[level - 1];
+
+  /* Recycles a freed node */
+  if (size_class->free_list) {
+    node = size_class->free_list;
+    size_class->free_list = *(void **)node;
+    return node;
+  }
+
+  /* Starts a new chunk */
+  if (size_class->cursor == size_class->end) {
+    struct jrsl_slab_chunk_t *chunk = (struct jrsl_slab_chunk_t *)malloc(
+        sizeof(struct jrsl_slab_chunk_t) + slab->chunk_nodes * size);
+    if (!chunk)
+      return NULL;
+    chunk->next = (struct jrsl_slab_chunk_t *)slab->chunks;
+    slab->chunks = chunk;
+    size_class->cursor = (char *)(chunk + 1);
+    size_class->end = size_class->cursor + slab->chunk_nodes * size;
+  }
+
+  node = size_class->cursor;
+  size_class->cursor += size;
+  return node;
+}
+
+static void jrsl_slab_free(void *context, void *ptr, size_t size,
+                           unsigned short level) {
+  jrsl_slab_t *slab = (jrsl_slab_t *)context;
+  struct jrsl_slab_class_t *size_class = &slab->classes[level - 1];
+
+  (void)size;
+  *(void **)ptr = size_class->free_list;
+  size_class->free_list = ptr;
+}
+
+static void jrsl_slab_release_context(void *context) {
+  jrsl_slab_release((jrsl_slab_t *)context);
+}
+
+/* Initializes a slab allocator. Every chunk will hold `chunk_nodes` nodes of a
+ * single level. */
+void jrsl_slab_init(jrsl_slab_t *slab, size_t chunk_nodes) {
+  slab->chunk_nodes = chunk_nodes > 0 ? chunk_nodes : 1;
+  slab->class_count = 0;
+  slab->classes = NULL;
+  slab->chunks = NULL;
+}
+
+/* Frees every chunk of the slab at once. The slab can be used again
+ * afterwards. */
+void jrsl_slab_release(jrsl_slab_t *slab) {
+  struct jrsl_slab_chunk_t *chunk = (struct jrsl_slab_chunk_t *)slab->chunks;
+  while (chunk) {
+    struct jrsl_slab_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(slab->classes);
+  jrsl_slab_init(slab, slab->chunk_nodes);
+}
+
+/* Returns an allocator drawing from `slab`. Since `jrsl_destroy` releases the
+ * whole slab, a slab should only back a single skip list. */
+jrsl_allocator_t jrsl_slab_allocator(jrsl_slab_t *slab) {
+  jrsl_allocator_t allocator;
+  allocator.alloc = jrsl_slab_alloc;
+  allocator.free = jrsl_slab_free;
+  allocator.release = jrsl_slab_release_context;
+  allocator.context = slab;
+  return allocator;
+}
+
+/* Initializes the head of the skip list. Helper function used in
+ * `jrsl_initialize`.*/
+static void jrsl_init_head(skip_list_t *skip_list) {
+  skip_node_t *head = jrsl_alloc_node(skip_list, skip_list->max_level);
+
+  size_t i;
+
+  head->data = NULL;
+  head->key = NULL;
+
+  /* Every level is cleared, readers may look at a level before it's used */
+  for (i = 0; i < skip_list->max_level; ++i) {
+    head->forward[i].node = NULL;
+    head->forward[i].width = 0;
+  }
+  JRSL_SNAPSHOT_LINK(head, NULL);
+
+  skip_list->head = head;
+  skip_list->tail = NULL;
+}
+
+/* Returns the width from which `max_level` levels are too few for the
+ * probability `p`: the levels above the first would then stop at the 1/p^3
+ * nodes of the last one instead of thinning out. */
+static size_t jrsl_grow_width(float p, unsigned short max_level) {
+  double width;
+  if (max_level >= JRSL_MAX_LEVEL || !(p > 0 && p < 1))
+    return (size_t)-1;
+  width = pow(1 / p, max_level + 1);
+  return width < (double)(size_t)-1 ? (size_t)width : (size_t)-1;
+}
+
+/* Makes the head of the skip list long enough for `level` links and for a
+ * width of `width`, replacing it with a longer one if needed. The caller holds
+ * the write lock and no pointer to the old head. */
+static void jrsl_reserve(skip_list_t *skip_list, size_t width,
+                         unsigned short level) {
+  unsigned short max_level = skip_list->max_level;
+  skip_node_t *old = skip_list->head;
+  skip_node_t *head;
+  size_t i;
+
+  if (width < skip_list->grow_width && level <= max_level)
+    return;
+  while (max_level < JRSL_MAX_LEVEL &&
+         (max_level < level ||
+          width >= jrsl_grow_width(skip_list->p, max_level)))
+    ++max_level;
+  if (max_level == skip_list->max_level)
+    return;
+
+  head = jrsl_alloc_node(skip_list, max_level);
+  head->data = NULL;
+  head->key = NULL;
+  for (i = 0; i < max_level; ++i) {
+    if (i < skip_list->level) {
+      head->forward[i] = old->forward[i];
+    } else {
+      head->forward[i].node = NULL;
+      head->forward[i].width = 0;
+    }
+  }
+
+  JRSL_SNAPSHOT_LINK(head, old->snapshot_next);
+
+  skip_list->max_level = max_level;
+  skip_list->grow_width = jrsl_grow_width(skip_list->p, max_level);
+  /* Readers may still be walking the old head */
+  JRSL_PUBLISH(skip_list->head, head);
+  jrsl_snapshot_retire(skip_list, old);
+}
+
+/* Returns the number of levels to walk from `head`, the head a reader loaded.
+ * A writer growing the head may have raised the level of the list past the
+ * links of the old one since, the reader retries then anyway. */
+static size_t jrsl_read_level(skip_list_t *skip_list, skip_node_t *head) {
+  size_t level = skip_list->level;
+  return level < head->level ? level : head->level;
+}
+
+/* Initializes a skip list. */
+void jrsl_initialize(skip_list_t *skip_list, comparator_t comparator,
+                     key_destructor_t key_destructor, float p,
+                     unsigned short max_level) {
+  assert(max_level <= JRSL_MAX_LEVEL);
+
+  skip_list->level = 1U;
+  skip_list->width = 0;
+  skip_list->max_level = max_level;
+  skip_list->grow_width = jrsl_grow_width(p, max_level);
+  skip_list->p = p;
+  skip_list->comparator = comparator;
+  skip_list->key_destructor = key_destructor;
+
+  skip_list->allocator.alloc = jrsl_default_alloc;
+  skip_list->allocator.free = jrsl_default_free;
+  skip_list->allocator.release = NULL;
+  skip_list->allocator.context = NULL;
+
+  jrsl_rng_init(&skip_list->rng, p, 0);
+  skip_list->deterministic = 0;
+
+#ifdef JRSL_OPTIMISTIC
+  skip_list->version = 0;
+  skip_list->retired = NULL;
+#endif
+#ifdef JRSL_WAL
+  skip_list->log = NULL;
+#endif
+#ifdef JRSL_STATS
+  memset(&skip_list->stats, 0, sizeof(skip_list->stats));
+#endif
+#ifdef JRSL_AGGREGATE
+  memset(&skip_list->aggregator, 0, sizeof(skip_list->aggregator));
+#endif
+#ifdef JRSL_SNAPSHOTS
+  skip_list->snapshot_version = 0;
+  skip_list->oldest = NULL;
+  skip_list->newest = NULL;
+  skip_list->dead = NULL;
+  skip_list->garbage = NULL;
+#endif
+
+  jrsl_init_head(skip_list);
+}
+
+/* Seeds the generator of the levels of the skip list. Lists with the same seed
+ * which go through the same operations have the same structure. */
+void jrsl_seed(skip_list_t *skip_list, unsigned long seed) {
+  jrsl_rng_init(&skip_list->rng, skip_list->p, seed);
+}
+
+/* Makes an empty skip list deterministic: instead of drawing random levels,
+ * `jrsl_insert`, `jrsl_insert_batch` and `jrsl_remove` (or `jrsl_remove_at`)
+ * promote and demote nodes to keep the 1-2-3 rules of Munro, Papadakis and
+ * Sedgewick. Between two consecutive nodes of a level, the level below holds 1
+ * to 3 nodes, so the list has at most log2(n) + 1 levels and every operation
+ * makes O(log n) comparisons in the worst case, with O(log^2 n) link updates
+ * when nodes move between levels. `p` is then unused. The other updates (bulk
+ * builds, ranges, splits, merges, `jrsl_rebalance`) keep the list correct but
+ * may break these rules, and any update may move a key to another node. */
+void jrsl_set_deterministic(skip_list_t *skip_list) {
+  assert(skip_list->width == 0);
+  skip_list->deterministic = 1;
+}
+
+#ifdef JRSL_AGGREGATE
+/* Registers the aggregate kept on every link and computes it for the elements
+ * already in the list, in O(n). The aggregate of an element is only computed
+ * again when it is inserted or replaced, so after changing what `measure`
+ * reads in its data, insert it again with the same key and data. Lists
+ * exchanging nodes (splits, concatenations, merges) must have the same
+ * aggregator. Not thread safe. */
+void jrsl_set_aggregator(skip_list_t *skip_list,
+                         const jrsl_aggregator_t *aggregator) {
+  size_t i;
+  skip_list->aggregator = *aggregator;
+  for (i = 0; i < skip_list->level; ++i) {
+    skip_node_t *x;
+    for (x = skip_list->head; x; x = x->forward[i].node)
+      jrsl_aggregate_link(skip_list, x, i);
+  }
+}
+#endif
+
+/* Replaces the allocator of an empty skip list. */
+void jrsl_set_allocator(skip_list_t *skip_list,
+                        const jrsl_allocator_t *allocator) {
+  assert(skip_list->width == 0);
+  JRSL_NO_SNAPSHOT(skip_list);
+
+  jrsl_free_node(skip_list, skip_list->head);
+  skip_list->allocator = *allocator;
+  jrsl_init_head(skip_list);
+}
+
+#ifdef JRSL_OPTIMISTIC
+/* Frees the nodes removed so far. No reader may be running. */
+void jrsl_reclaim(skip_list_t *skip_list) {
+  skip_node_t *node = skip_list->retired;
+  while (node) {
+    skip_node_t *next = (skip_node_t *)node->data;
+    jrsl_free_node(skip_list, node);
+    node = next;
+  }
+  skip_list->retired = NULL;
+}
+#endif
+
+/* Destroys a skip list. Node visitor is applied to every node before the node
+ * is freed. If the allocator can release all of its nodes at once, they are
+ * released after the visits instead of being freed one by one, and without a
+ * node visitor the list is not walked at all.*/
+void jrsl_destroy(skip_list_t *skip_list, node_visitor_t node_visitor) {
+  skip_node_t *node = skip_list->head;
+
+  JRSL_NO_SNAPSHOT(skip_list);
+#ifdef JRSL_OPTIMISTIC
+  jrsl_reclaim(skip_list);
+#endif
+
+  if (!node_visitor && skip_list->allocator.release) {
+    skip_list->allocator.release(skip_list->allocator.context);
+    return;
+  }
+
+  while (node) {
+    skip_node_t *next_node = node->forward[0].node;
+
+    if (node_visitor)
+      node_visitor(node->key, node->data);
+    if (!skip_list->allocator.release)
+      jrsl_free_node(skip_list, node);
+    node = next_node;
+  }
+
+  if (skip_list->allocator.release)
+    skip_list->allocator.release(skip_list->allocator.context);
+}
+
+/* Returns the node with index `index`. If `index` is greater than the width of
+ * the skip list, returns NULL. This is a helper function used in `jrsl_key_at`
+ * and `jrsl_data_at`.*/
+static skip_node_t *jrsl_node_at(skip_list_t *skip_list, size_t index) {
+  size_t i, w;
+  skip_node_t *x; /* skip node traveler */
+
+  if (index >= skip_list->width)
+    return NULL;
+
+  /* The remaining width to travel. `index` is incremented by 1 because of the
+   * presence of a head in the skip list. */
+  w = index + 1;
+
+  x = JRSL_LOAD(skip_list->head);
+  JRSL_STAT_ADD(skip_list, operations, 1);
+
+  for (i = jrsl_read_level(skip_list, x); i > 0; --i) {
+    skip_node_t *next;
+    while ((next = JRSL_LOAD(x->forward[i - 1].node)) &&
+           x->forward[i - 1].width <= w) {
+      JRSL_PREFETCH(next->forward[i - 1].node);
+      w -= x->forward[i - 1].width;
+      x = next;
+      JRSL_STAT_ADD(skip_list, hops, 1);
+      if (w == 0)
+        return x;
+    }
+  }
+  /* This should never be reached because of the initial check, unless the
+   * list changed under an optimistic reader. */
+  return NULL;
+}
+
+/* Returns the key of the `index`th element of the skip list.*/
+void *jrsl_key_at(skip_list_t *skip_list, size_t index) {
+  skip_node_t *node;
+  void *key;
+  unsigned long version;
+
+  do {
+    version = JRSL_READ_BEGIN(skip_list);
+    node = jrsl_node_at(skip_list, index);
+    key = node ? node->key : NULL;
+  } while (JRSL_READ_RETRY(skip_list, version));
+  return key;
+}
+
+/* Returns the data of the `index`th element of the skip list.*/
+void *jrsl_data_at(skip_list_t *skip_list, size_t index) {
+  skip_node_t *node;
+  void *data;
+  unsigned long version;
+
+  do {
+    version = JRSL_READ_BEGIN(skip_list);
+    node = jrsl_node_at(skip_list, index);
+    data = node ? node->data : NULL;
+  } while (JRSL_READ_RETRY(skip_list, version));
+  return data;
+}
+
+/* Returns the data of the node with the key `key`. If `key` is not in
+ * the skip list returns NULL.
+ */
+void *jrsl_search(skip_list_t *skip_list, void *key) {
+  size_t i;
+  skip_node_t *x;
+  void *data;
+  unsigned long version;
+
+  do {
+    version = JRSL_READ_BEGIN(skip_list);
+    x = JRSL_LOAD(skip_list->head);
+    JRSL_STAT_ADD(skip_list, operations, 1);
+
+    for (i = jrsl_read_level(skip_list, x); i > 0; --i) {
+      skip_node_t *next;
+      while ((next = JRSL_LOAD(x->forward[i - 1].node)) != NULL) {
+        JRSL_PREFETCH(next->forward[i - 1].node);
+        if (JRSL_CMP(skip_list, next->key, key) >= 0)
+          break;
+        x = next;
+        JRSL_STAT_ADD(skip_list, hops, 1);
+      }
+    }
+    x = JRSL_LOAD(x->forward[0].node);
+
+    data = NULL;
+    if (x)
+      if (JRSL_CMP(skip_list, x->key, key) == 0) {
+        data = x->data;
+      }
+  } while (JRSL_READ_RETRY(skip_list, version));
+
+  return data;
+}
+
+/* Number of searches `jrsl_search_many` runs side by side */
+#ifndef JRSL_SEARCH_GROUP
+#define JRSL_SEARCH_GROUP 8
+#endif
+
+/* Searches the `n` keys of `keys` and stores their data (or NULL) in `out`.
+ * The searches are run by groups of `JRSL_SEARCH_GROUP`, each of them taking a
+ * step in turn and prefetching the node it will look at next, so that the
+ * cache misses of a group overlap instead of following each other. */
+void jrsl_search_many(skip_list_t *skip_list, void **keys, size_t n,
+                      void **out) {
+  size_t start;
+
+  for (start = 0; start < n; start += JRSL_SEARCH_GROUP) {
+    size_t count =
+        n - start < JRSL_SEARCH_GROUP ? n - start : JRSL_SEARCH_GROUP;
+    skip_node_t *x[JRSL_SEARCH_GROUP];
+    /* The remaining levels of each search, 0 once it is done */
+    size_t level[JRSL_SEARCH_GROUP];
+    size_t j, running;
+    unsigned long version;
+
+    do {
+      version = JRSL_READ_BEGIN(skip_list);
+      for (j = 0; j < count; ++j) {
+        x[j] = JRSL_LOAD(skip_list->head);
+        level[j] = jrsl_read_level(skip_list, x[j]);
+      }
+      JRSL_STAT_ADD(skip_list, operations, count);
+
+      running = count;
+      while (running) {
+        for (j = 0; j < count; ++j) {
+          skip_node_t *next;
+          char cmp = 1;
+
+          if (!level[j])
+            continue;
+          next = JRSL_LOAD(x[j]->forward[level[j] - 1].node);
+          if (next)
+            cmp = JRSL_CMP(skip_list, next->key, keys[start + j]);
+
+          if (cmp < 0) {
+            x[j] = next;
+            JRSL_STAT_ADD(skip_list, hops, 1);
+          } else if (--level[j] == 0) {
+            out[start + j] = cmp == 0 ? next->data : NULL;
+            --running;
+            continue;
+          }
+          JRSL_PREFETCH_HINT(x[j]->forward[level[j] - 1].node);
+        }
+      }
+    } while (JRSL_READ_RETRY(skip_list, version));
+  }
+}
+
+/* Links a new node holding `key` and `data` right after `update[0]`.
+ * `update[i]` is the last node before the new node on level `i` and
+ * `update_rank[i]` is its rank (the head has rank 0). Both arrays are moved to
+ * the new node where it is linked, so they stay valid for a greater key. */
+static skip_node_t *jrsl_link_new_node(skip_list_t *skip_list,
+                                       skip_node_t **update,
+                                       size_t *update_rank, void *key,
+                                       void *data) {
   size_t i;              /* used in for loops */
-  skip_node_t *x;        /* skip node traveler */
   unsigned short level;  /* the level of the new node */
   skip_node_t *new_node; /* the new node */
+  size_t rank;           /* the rank of the new node */
+
+  /* The level for the new node, deterministic lists only insert on the first
+   * level and promote nodes beforehand. */
+  level = skip_list->deterministic ? 1 : jrsl_random_level(skip_list);
+
+  /* sanity check */
+  assert(level < skip_list->max_level);
+
+  /*  Completes the helper arrays if the new node is the first node on a (new)
+   * level.*/
+  if (level > skip_list->level) {
+    for (i = skip_list->level; i < level; ++i) {
+      update[i] = skip_list->head;
+      update_rank[i] = 0;
+
+      /* The width to NULL is always 0 */
+      skip_list->head->forward[i].node = NULL;
+      skip_list->head->forward[i].width = 0;
+    }
+    skip_list->level = level;
+  }
+
+  /* The node and its links are a single allocation. */
+  new_node = jrsl_alloc_node(skip_list, level);
+
+  new_node->data = data;
+  new_node->key = key;
+
+  /* Keeps the lowest level links in both directions */
+#ifdef JRSL_BACKWARD
+  new_node->backward = update[0] == skip_list->head ? NULL : update[0];
+  if (update[0]->forward[0].node)
+    update[0]->forward[0].node->backward = new_node;
+#endif
+  if (!update[0]->forward[0].node)
+    skip_list->tail = new_node;
+
+#ifdef JRSL_SNAPSHOTS
+  {
+    /* Removed nodes may lie between the new node and the one before it */
+    skip_node_t *pred = update[0];
+    while (pred->snapshot_next != update[0]->forward[0].node &&
+           JRSL_CMP(skip_list, pred->snapshot_next->key, key) < 0)
+      pred = pred->snapshot_next;
+    new_node->snapshot_next = pred->snapshot_next;
+    JRSL_SNAPSHOT_LINK(pred, new_node);
+  }
+#endif
+
+  /* Inserts the new node in the list. */
+  rank = update_rank[0] + 1;
+  for (i = 0; i < level; ++i) {
+    struct link *link = &update[i]->forward[i];
+
+    /* Update the linked nodes. */
+    new_node->forward[i].node = link->node;
+
+    /* Updates the widths of the links. The new node takes whatever was after
+     * it in the previous link, + 1 because we are inserting a node. */
+    if (link->node)
+      new_node->forward[i].width = update_rank[i] + link->width + 1 - rank;
+    else
+      /* The width to NULL is always 0. */
+      new_node->forward[i].width = 0;
+
+    JRSL_PUBLISH(link->node, new_node);
+    link->width = rank - update_rank[i];
+    JRSL_AGGREGATE_LINK(skip_list, update[i], i);
+    JRSL_AGGREGATE_LINK(skip_list, new_node, i);
+
+    update[i] = new_node;
+    update_rank[i] = rank;
+  }
+
+  /* Updates the widths of the links above the newly created node. */
+  for (i = level; i < skip_list->level; ++i) {
+    if (update[i]->forward[i].node) {
+      ++update[i]->forward[i].width;
+      JRSL_AGGREGATE_LINK(skip_list, update[i], i);
+    } else {
+      /* The width to NULL is always 0 and does not need updating. All links
+       * above a link pointing to NULL will point to NULL. */
+      break;
+    }
+  }
+
+  skip_list->width++;
+  return new_node;
+}
+
+/* Returns the last node whose key is less than `key`, or not greater than `key`
+ * if `inclusive` is set. The head is returned if there is no such node. Its
+ * rank (the head has rank 0) is stored in `rank`. */
+static skip_node_t *jrsl_find_before(skip_list_t *skip_list, void *key,
+                                     char inclusive, size_t *rank) {
+  size_t i;
+  skip_node_t *x = JRSL_LOAD(skip_list->head);
+  size_t r = 0;
+
+  JRSL_STAT_ADD(skip_list, operations, 1);
+  /* `comparator(...) < inclusive` reads `< 0` or `<= 0` */
+  for (i = jrsl_read_level(skip_list, x); i > 0; --i) {
+    skip_node_t *next;
+    while ((next = JRSL_LOAD(x->forward[i - 1].node)) != NULL &&
+           JRSL_CMP(skip_list, next->key, key) < inclusive) {
+      r += x->forward[i - 1].width;
+      x = next;
+      JRSL_STAT_ADD(skip_list, hops, 1);
+    }
+  }
+
+  *rank = r;
+  return x;
+}
+
+/* Returns the first node whose key is not less than `key`, or NULL if there is
+ * none. If `rank` is not NULL, the index of that node (or the width of the list)
+ * is stored in it. */
+skip_node_t *jrsl_lower_bound(skip_list_t *skip_list, void *key,
+                              size_t *rank) {
+  size_t r;
+  skip_node_t *x = jrsl_find_before(skip_list, key, 0, &r);
+  if (rank)
+    *rank = r;
+  return x->forward[0].node;
+}
+
+/* Returns the first node whose key is greater than `key`, or NULL if there is
+ * none. If `rank` is not NULL, the index of that node (or the width of the list)
+ * is stored in it. */
+skip_node_t *jrsl_upper_bound(skip_list_t *skip_list, void *key,
+                              size_t *rank) {
+  size_t r;
+  skip_node_t *x = jrsl_find_before(skip_list, key, 1, &r);
+  if (rank)
+    *rank = r;
+  return x->forward[0].node;
+}
+
+/* Returns the index of the element with the key `key`. If `key` is not in the
+ * skip list, returns the index it would have if it was inserted, which is the
+ * number of keys less than `key`. */
+size_t jrsl_rank(skip_list_t *skip_list, void *key) {
+  size_t rank;
+  unsigned long version;
+
+  do {
+    version = JRSL_READ_BEGIN(skip_list);
+    jrsl_find_before(skip_list, key, 0, &rank);
+  } while (JRSL_READ_RETRY(skip_list, version));
+  return rank;
+}
+
+/* Applies `node_visitor` to every element whose key is in [lo, hi), in order,
+ * and returns their number. The list is searched once for `lo` and then walked
+ * on its lowest level. If `first_rank` is not NULL, the index of the first of
+ * these elements is stored in it. */
+size_t jrsl_range(skip_list_t *skip_list, void *lo, void *hi,
+                  node_visitor_t node_visitor, size_t *first_rank) {
+  size_t count = 0;
+  skip_node_t *x = jrsl_lower_bound(skip_list, lo, first_rank);
+
+  while (x && JRSL_CMP(skip_list, x->key, hi) < 0) {
+    node_visitor(x->key, x->data);
+    ++count;
+    x = x->forward[0].node;
+  }
+  return count;
+}
+
+/* Returns the first node of the skip list, or NULL if it's empty. */
+skip_node_t *jrsl_first(skip_list_t *skip_list) {
+  return skip_list->head->forward[0].node;
+}
+
+/* Returns the last node of the skip list, or NULL if it's empty. */
+skip_node_t *jrsl_last(skip_list_t *skip_list) { return skip_list->tail; }
+
+/* Returns the node after `node`, or NULL if it's the last one. */
+skip_node_t *jrsl_next(skip_node_t *node) { return node->forward[0].node; }
+
+/* Returns the node before `node`, or NULL if it's the first one. This is O(1)
+ * with `JRSL_BACKWARD`, and a search for the key of `node` otherwise. */
+skip_node_t *jrsl_prev(skip_list_t *skip_list, skip_node_t *node) {
+#ifdef JRSL_BACKWARD
+  (void)skip_list;
+  return node->backward;
+#else
+  size_t rank;
+  skip_node_t *x = jrsl_find_before(skip_list, node->key, 0, &rank);
+  return rank ? x : NULL;
+#endif
+}
+
+/* Applies `node_visitor` to every element whose key is in [lo, hi), from the
+ * greatest key down, and returns their number. If `end_rank` is not NULL, the
+ * number of keys less than `hi` is stored in it: the first element visited is
+ * at index `*end_rank - 1`. */
+size_t jrsl_range_reverse(skip_list_t *skip_list, void *lo, void *hi,
+                          node_visitor_t node_visitor, size_t *end_rank) {
+  size_t count = 0;
+  size_t rank;
+  skip_node_t *x = jrsl_find_before(skip_list, hi, 0, &rank);
+
+  if (end_rank)
+    *end_rank = rank;
+  if (!rank)
+    return 0;
+
+  while (x && JRSL_CMP(skip_list, x->key, lo) >= 0) {
+    node_visitor(x->key, x->data);
+    ++count;
+    x = jrsl_prev(skip_list, x);
+  }
+  return count;
+}
+
+#ifdef JRSL_AGGREGATE
+/* Returns the aggregate of the elements after `x`, whose rank is `rank`, up to
+ * the rank `end`. Each step follows the longest link which does not go past
+ * `end`, climbing and then descending the levels. */
+static JRSL_AGGREGATE jrsl_aggregate_to(skip_list_t *skip_list, skip_node_t *x,
+                                        size_t rank, size_t end) {
+  jrsl_aggregator_t *aggregator = &skip_list->aggregator;
+  JRSL_AGGREGATE value = aggregator->identity;
+
+  assert(aggregator->combine);
+  while (rank < end) {
+    size_t i = x->level < skip_list->level ? x->level : skip_list->level;
+    skip_node_t *next;
+
+    while (i > 1 && (!x->forward[i - 1].node ||
+                     rank + x->forward[i - 1].width > end))
+      --i;
+    /* Only NULL if a writer changed the list, the reader retries */
+    if ((next = JRSL_LOAD(x->forward[i - 1].node)) == NULL)
+      break;
+    value = aggregator->combine(value, x->forward[i - 1].aggregate);
+    rank += x->forward[i - 1].width;
+    x = next;
+    JRSL_STAT_ADD(skip_list, hops, 1);
+  }
+  return value;
+}
+
+/* Returns the aggregate of the elements whose key is less than `key`, the
+ * identity if there is none. */
+JRSL_AGGREGATE jrsl_prefix_aggregate(skip_list_t *skip_list, void *key) {
+  JRSL_AGGREGATE value;
+  size_t rank;
+  unsigned long version;
+
+  do {
+    version = JRSL_READ_BEGIN(skip_list);
+    jrsl_find_before(skip_list, key, 0, &rank);
+    value =
+        jrsl_aggregate_to(skip_list, JRSL_LOAD(skip_list->head), 0, rank);
+  } while (JRSL_READ_RETRY(skip_list, version));
+  return value;
+}
+
+/* Returns the aggregate of the elements whose key is in [lo, hi), the identity
+ * if there is none. The operation need not be invertible, the aggregate is
+ * combined from the links spanning the range rather than from two prefixes. */
+JRSL_AGGREGATE jrsl_range_aggregate(skip_list_t *skip_list, void *lo,
+                                    void *hi) {
+  JRSL_AGGREGATE value;
+  skip_node_t *x;
+  size_t rank, end;
+  unsigned long version;
+
+  do {
+    version = JRSL_READ_BEGIN(skip_list);
+    x = jrsl_find_before(skip_list, lo, 0, &rank);
+    jrsl_find_before(skip_list, hi, 0, &end);
+    value = jrsl_aggregate_to(skip_list, x, rank, end);
+  } while (JRSL_READ_RETRY(skip_list, version));
+  return value;
+}
+#endif
+
+/* Fills `pred` with the last node before `node` on the `level` lowest levels.
+ * `start` is a node before `node` on all of them. */
+static void jrsl_find_preds(skip_node_t *start, skip_node_t *node,
+                            unsigned short level, skip_node_t **pred) {
+  size_t i;
+  for (i = level; i > 0; --i) {
+    while (start->forward[i - 1].node != node)
+      start = start->forward[i - 1].node;
+    pred[i - 1] = start;
+  }
+}
+
+/* Replaces `node` with a copy having `level` links, the links above its own
+ * pointing to NULL. `pred[i]` is the last node before it on level `i`.
+ * Returns the copy. */
+static skip_node_t *jrsl_resize_node(skip_list_t *skip_list, skip_node_t *node,
+                                     unsigned short level, skip_node_t **pred) {
+  skip_node_t *copy = jrsl_alloc_node(skip_list, level);
+  size_t i;
+
+  copy->key = node->key;
+  copy->data = node->data;
+  for (i = 0; i < level; ++i) {
+    if (i < node->level) {
+      copy->forward[i] = node->forward[i];
+    } else {
+      copy->forward[i].node = NULL;
+      copy->forward[i].width = 0;
+    }
+  }
+#ifdef JRSL_BACKWARD
+  copy->backward = node->backward;
+  if (node->forward[0].node)
+    node->forward[0].node->backward = copy;
+#endif
+  if (skip_list->tail == node)
+    skip_list->tail = copy;
+#ifdef JRSL_SNAPSHOTS
+  /* The copy follows the node on the snapshot chain. The snapshots which may
+   * see the node keep it, the newer ones only see the copy. */
+  if (!jrsl_snapshot_keeps(skip_list, node))
+    copy->birth = node->birth;
+  JRSL_SNAPSHOT_LINK(copy, node->snapshot_next);
+  JRSL_SNAPSHOT_LINK(node, copy);
+#endif
+
+  for (i = 0; i < level && i < node->level; ++i)
+    JRSL_PUBLISH(pred[i]->forward[i].node, copy);
+  jrsl_release_node(skip_list, pred[0], node);
+  return copy;
+}
+
+/* Adds a level to `node`, linking it after `pred` which is the last node before
+ * it on that level. Returns the node, which is reallocated. */
+static skip_node_t *jrsl_promote(skip_list_t *skip_list, skip_node_t *pred,
+                                 skip_node_t *node) {
+  unsigned short level = node->level; /* the index of the new link */
+  skip_node_t *update[JRSL_MAX_LEVEL];
+  skip_node_t *x = pred;
+  size_t width;
+  struct link *link = &pred->forward[level];
+
+  assert(level < skip_list->max_level);
+  if (level == skip_list->level) {
+    /* The width to NULL is always 0 */
+    link->node = NULL;
+    link->width = 0;
+    skip_list->level++;
+  }
+
+  /* The new link spans the links below it from `pred` to `node` */
+  width = x->forward[level - 1].width;
+  while (x->forward[level - 1].node != node) {
+    x = x->forward[level - 1].node;
+    width += x->forward[level - 1].width;
+  }
+  jrsl_find_preds(x, node, level, update);
+  node = jrsl_resize_node(skip_list, node, level + 1, update);
+
+  node->forward[level].node = link->node;
+  node->forward[level].width = link->node ? link->width - width : 0;
+  link->width = width;
+  JRSL_PUBLISH(link->node, node);
+  JRSL_AGGREGATE_LINK(skip_list, pred, level);
+  JRSL_AGGREGATE_LINK(skip_list, node, level);
+  return node;
+}
+
+/* Removes the highest level of `node`, `pred` being the last node before it on
+ * that level. Returns the node, which is reallocated. */
+static skip_node_t *jrsl_demote(skip_list_t *skip_list, skip_node_t *pred,
+                                skip_node_t *node) {
+  unsigned short level = node->level - 1; /* the index of the removed link */
+  skip_node_t *update[JRSL_MAX_LEVEL];
+  struct link *link = &pred->forward[level];
+
+  assert(level > 0);
+  link->width = node->forward[level].node
+                    ? link->width + node->forward[level].width
+                    : 0;
+  JRSL_PUBLISH(link->node, node->forward[level].node);
+  JRSL_AGGREGATE_LINK(skip_list, pred, level);
+  jrsl_find_preds(pred, node, level, update);
+  return jrsl_resize_node(skip_list, node, level, update);
+}
+
+/* The search path of `jrsl_insert` in a deterministic list, see
+ * `jrsl_find_rank` for `update` and `update_rank`. On the way down, every gap
+ * of 3 nodes between two nodes of the level above is split by promoting its
+ * middle node, so that the new node makes at most 3. Returns `update[0]`. */
+static skip_node_t *jrsl_descend_123(skip_list_t *skip_list, void *key,
+                                     skip_node_t **update,
+                                     size_t *update_rank) {
+  size_t i;
+  skip_node_t *x;
+  size_t rank = 0;
+
+  /* The list may get a new level */
+  jrsl_reserve(skip_list, skip_list->width + 1, skip_list->level + 1);
+  x = skip_list->head;
+
+  JRSL_STAT_ADD(skip_list, operations, 1);
+  for (i = skip_list->level; i > 0; --i) {
+    skip_node_t *next;
+    /* The end of the gap below `x` and its nodes */
+    skip_node_t *end = i < skip_list->level ? x->forward[i].node : NULL;
+    skip_node_t *first = x->forward[i - 1].node;
+    skip_node_t *middle = first != end ? first->forward[i - 1].node : end;
+
+    if (middle != end && middle->forward[i - 1].node != end) {
+      middle = jrsl_promote(skip_list, x, middle);
+      update[i] = x;
+      update_rank[i] = rank;
+      if (JRSL_CMP(skip_list, middle->key, key) < 0) {
+        rank += x->forward[i].width;
+        x = middle;
+        update[i] = x;
+        update_rank[i] = rank;
+      }
+    }
+
+    while ((next = x->forward[i - 1].node) != NULL) {
+      if (JRSL_CMP(skip_list, next->key, key) >= 0)
+        break;
+      rank += x->forward[i - 1].width;
+      x = next;
+      JRSL_STAT_ADD(skip_list, hops, 1);
+    }
+    update[i - 1] = x;
+    update_rank[i - 1] = rank;
+  }
+  return x;
+}
+
+/* Inserts a new element in the skip list and returns NULL. If an element with
+ * that key is already in the list, updates that element and returns the
+ * previous data. */
+void *jrsl_insert(skip_list_t *skip_list, void *key, void *data) {
+  size_t i;       /* used in for loops */
+  skip_node_t *x; /* skip node traveler */
+  size_t rank;    /* the rank of the skip node traveler */
+
+  /* Helper array of pointers to elements that will need updating. */
+  skip_node_t *update[JRSL_MAX_LEVEL];
+
+  /* Helper array of the ranks of these elements, to update widths. */
+  size_t update_rank[JRSL_MAX_LEVEL];
+
+  JRSL_WRITE_BEGIN(skip_list);
+  JRSL_LOG(skip_list, JRSL_LOG_INSERT, key, data);
+  jrsl_reserve(skip_list, skip_list->width + 1, 0);
+
+  /* Finds the correct spot for the key in the skip list. */
+  if (skip_list->deterministic) {
+    x = jrsl_descend_123(skip_list, key, update, update_rank);
+  } else {
+    x = skip_list->head;
+    rank = 0;
+    JRSL_STAT_ADD(skip_list, operations, 1);
+    for (i = skip_list->level; i > 0; --i) {
+      skip_node_t *next;
+      while ((next = x->forward[i - 1].node) != NULL) {
+        JRSL_PREFETCH(next->forward[i - 1].node);
+        if (JRSL_CMP(skip_list, next->key, key) >= 0)
+          break;
+        rank += x->forward[i - 1].width;
+        x = next;
+        JRSL_STAT_ADD(skip_list, hops, 1);
+      }
+
+      update[i - 1] = x;
+      update_rank[i - 1] = rank;
+    }
+  }
+
+  /* If the node is already in the list, retuns the already existing node. */
+  if (x->forward[0].node) {
+    if (JRSL_CMP(skip_list, x->forward[0].node->key, key) == 0) {
+      skip_node_t *node = x->forward[0].node;
+      void *old = node->data;
+      JRSL_COPY_ON_WRITE(skip_list, node, update);
+      node->data = data;
+      JRSL_AGGREGATE_PATH(skip_list, update, skip_list->level);
+      JRSL_WRITE_END(skip_list);
+      return old;
+    }
+  }
+
+  jrsl_link_new_node(skip_list, update, update_rank, key, data);
+  JRSL_WRITE_END(skip_list);
+  return NULL;
+}
+
+/* `jrsl_insert_batch`, which also sets `found[j]` (unless `found` is NULL) to
+ * whether the key `keys[j]` was already in the list. */
+static void jrsl_insert_sorted(skip_list_t *skip_list, void **keys,
+                               void **data, size_t n, void **old_data,
+                               char *found) {
+  size_t i, j; /* used in for loops */
+
+  /* The search path of the previous key, it starts at the head. */
+  skip_node_t *update[JRSL_MAX_LEVEL];
+  size_t update_rank[JRSL_MAX_LEVEL];
+
+  JRSL_WRITE_BEGIN(skip_list);
+  jrsl_reserve(skip_list, skip_list->width + n, 0);
+
+  for (i = 0; i < skip_list->level; ++i) {
+    update[i] = skip_list->head;
+    update_rank[i] = 0;
+  }
+
+  for (j = 0; j < n; ++j) {
+    void *key = keys[j];
+    skip_node_t *x = NULL; /* skip node traveler */
+    size_t rank = 0;       /* its rank */
+    char cmp = 1;          /* comparison of the next node with the key */
+
+    JRSL_LOG(skip_list, JRSL_LOG_INSERT, key, data ? data[j] : NULL);
+    if (found)
+      found[j] = 0;
+
+    if (skip_list->deterministic) {
+      skip_node_t *next;
+      x = jrsl_descend_123(skip_list, key, update, update_rank);
+      next = x->forward[0].node;
+      cmp = next ? JRSL_CMP(skip_list, next->key, key) : 1;
+    } else {
+      JRSL_STAT_ADD(skip_list, operations, 1);
+
+      /* Climbs up the path while the next node is still before the key. The
+       * path is already correct on the levels above. */
+      for (i = 0; i < skip_list->level; ++i) {
+        skip_node_t *next = update[i]->forward[i].node;
+        if (!next)
+          break;
+        cmp = JRSL_CMP(skip_list, next->key, key);
+        if (cmp >= 0)
+          break;
+      }
+      if (i > 0)
+        cmp = 1;
+
+      /* Walks back down, starting each level from the furthest of the node
+       * reached on the level above and the previous path. */
+      for (; i > 0; --i) {
+        if (!x || update_rank[i - 1] > rank) {
+          x = update[i - 1];
+          rank = update_rank[i - 1];
+        }
+
+        while (x->forward[i - 1].node) {
+          cmp = JRSL_CMP(skip_list, x->forward[i - 1].node->key, key);
+          if (cmp >= 0)
+            break;
+          rank += x->forward[i - 1].width;
+          x = x->forward[i - 1].node;
+          JRSL_STAT_ADD(skip_list, hops, 1);
+        }
+        if (!x->forward[i - 1].node)
+          cmp = 1;
+
+        update[i - 1] = x;
+        update_rank[i - 1] = rank;
+      }
+    }
+
+    if (cmp == 0) {
+      /* Already in the list, only updates the data. */
+      skip_node_t *node = update[0]->forward[0].node;
+      if (old_data)
+        old_data[j] = node->data;
+      if (found)
+        found[j] = 1;
+      JRSL_COPY_ON_WRITE(skip_list, node, update);
+      node->data = data ? data[j] : NULL;
+      JRSL_AGGREGATE_PATH(skip_list, update, skip_list->level);
+      continue;
+    }
+
+    jrsl_link_new_node(skip_list, update, update_rank, key,
+                       data ? data[j] : NULL);
+    if (old_data)
+      old_data[j] = NULL;
+  }
+
+  JRSL_WRITE_END(skip_list);
+}
+
+/* Inserts `n` elements whose keys are sorted in strictly increasing order.
+ * Each search starts from where the previous one ended instead of the head, so
+ * the cost depends on the distance between consecutive keys rather than on the
+ * size of the list. Like `jrsl_insert`, elements already in the list are
+ * updated; their previous data is stored in `old_data` (NULL for new elements)
+ * unless `old_data` is NULL. */
+void jrsl_insert_batch(skip_list_t *skip_list, void **keys, void **data,
+                       size_t n, void **old_data) {
+  jrsl_insert_sorted(skip_list, keys, data, n, old_data, NULL);
+}
+
+/* Unlinks `x` from the skip list, `update[i]` being the last node before it on
+ * every level, and frees it. Returns its data. */
+static void *jrsl_unlink_node(skip_list_t *skip_list, skip_node_t **update,
+                              skip_node_t *x) {
+  size_t i;
+  void *old;
+
+  /* Updates the list and removes the node */
+  for (i = 0; i < skip_list->level; ++i) {
+    struct link *link = &update[i]->forward[i];
+    if (link->node == x) {
+      JRSL_PUBLISH(link->node, x->forward[i].node);
+
+      if (x->forward[i].width > 0)
+        link->width += x->forward[i].width - 1;
+      else
+        link->width = 0;
+    } else if (link->node) {
+      --link->width;
+    }
+  }
+  JRSL_AGGREGATE_PATH(skip_list, update, skip_list->level);
+
+#ifdef JRSL_BACKWARD
+  if (x->forward[0].node)
+    x->forward[0].node->backward = x->backward;
+#endif
+  if (skip_list->tail == x)
+    skip_list->tail = update[0] == skip_list->head ? NULL : update[0];
+
+  old = x->data;
+  jrsl_release_node(skip_list, update[0], x);
+  skip_list->width--;
+
+  /* Updates the list's max level */
+  while (skip_list->level > 1 &&
+         !skip_list->head->forward[skip_list->level - 1].node)
+    --skip_list->level;
+
+  return old;
+}
+
+/* `jrsl_unlink_node` for a deterministic list. A gap left empty below a level
+ * takes a node from the next gap under the same node of the level above, or is
+ * merged with it when it has a single node, the same way up. */
+static void *jrsl_unlink_123(skip_list_t *skip_list, skip_node_t **update,
+                             skip_node_t *x) {
+  size_t j;
+  void *old;
+  skip_node_t *before = update[0];
+
+  /* A node on several levels trades elements with the node before it, which
+   * is only on the first level, and that one is unlinked instead. */
+  if (x->level > 1) {
+    void *key = x->key;
+    void *data = x->data;
+
+    if (before == skip_list->head || before->level > 1 ||
+        JRSL_SNAPSHOT_OPEN(skip_list))
+      /* The rules did not hold, or snapshots may see both elements */
+      return jrsl_unlink_node(skip_list, update, x);
+    x->key = before->key;
+    x->data = before->data;
+    before->key = key;
+    before->data = data;
+    x = before;
+    jrsl_find_preds(update[1], x, 1, update);
+  }
+  old = jrsl_unlink_node(skip_list, update, x);
+
+  /* `u` and `v` are consecutive nodes on level j + 1 and the level j is empty
+   * between them */
+  for (j = 0; j + 1 < skip_list->level; ++j) {
+    skip_node_t *u = update[j + 1];
+    skip_node_t *v = u->forward[j + 1].node;
+
+    if (u->forward[j].node != v)
+      break;
+
+    if (v && v->level == j + 2) {
+      /* The next gap, from `v` to `end` */
+      skip_node_t *first = v->forward[j].node;
+      skip_node_t *end = v->forward[j + 1].node;
+
+      jrsl_demote(skip_list, u, v);
+      if (first != end && first->forward[j].node != end) {
+        jrsl_promote(skip_list, u, first);
+        break;
+      }
+    } else if (u != skip_list->head && u->level == j + 2) {
+      /* The previous gap, from `t` to `u`, and its last node */
+      skip_node_t *t =
+          j + 2 < skip_list->level ? update[j + 2] : skip_list->head;
+      skip_node_t *last;
+
+      while (t->forward[j + 1].node != u)
+        t = t->forward[j + 1].node;
+      last = t;
+      while (last->forward[j].node != u)
+        last = last->forward[j].node;
+
+      jrsl_demote(skip_list, t, u);
+      if (last != t && t->forward[j].node != last) {
+        jrsl_promote(skip_list, t, last);
+        break;
+      }
+    } else {
+      /* The rules did not hold */
+      break;
+    }
+  }
+
+  while (skip_list->level > 1 &&
+         !skip_list->head->forward[skip_list->level - 1].node)
+    --skip_list->level;
+  return old;
+}
+
+/* Removes an element from the skip list and returns its data. If it's not
+ * in the list returns NULL. */
+void *jrsl_remove(skip_list_t *skip_list, void *key) {
+  size_t i;       /*used  in for loops */
+  skip_node_t *x; /* A skip node traveler */
+  void *old;      /* The data of the removed node */
+  /* Helper array of pointers to elements that will need updating. */
+  skip_node_t *update[JRSL_MAX_LEVEL];
+
+  JRSL_WRITE_BEGIN(skip_list);
+
+  /* Finds the theoretical location of the key. */
+  x = skip_list->head;
+  JRSL_STAT_ADD(skip_list, operations, 1);
+  for (i = skip_list->level; i > 0; --i) {
+    while (x->forward[i - 1].node != NULL &&
+           JRSL_CMP(skip_list, x->forward[i - 1].node->key, key) < 0) {
+      x = x->forward[i - 1].node;
+      JRSL_STAT_ADD(skip_list, hops, 1);
+    }
+    update[i - 1] = x;
+  }
+  x = x->forward[0].node;
+
+  /* Could not find the key in the skip list. */
+  if (!x || JRSL_CMP(skip_list, x->key, key) != 0) {
+    JRSL_WRITE_END(skip_list);
+    return NULL;
+  }
+
+  JRSL_LOG(skip_list, JRSL_LOG_REMOVE, x->key, NULL);
+  old = skip_list->deterministic ? jrsl_unlink_123(skip_list, update, x)
+                                 : jrsl_unlink_node(skip_list, update, x);
+  JRSL_WRITE_END(skip_list);
+  return old;
+}
+
+/* Fills `update` with the last node of rank at most `rank` on every level
+ * (the head has rank 0) and `update_rank` with their ranks, and returns the one
+ * of level 0. Only the widths are used, the comparator is never called. */
+static skip_node_t *jrsl_find_rank(skip_list_t *skip_list, size_t rank,
+                           skip_node_t **update, size_t *update_rank) {
+  size_t i;
+  skip_node_t *x = skip_list->head;
+  size_t r = 0;
+
+  JRSL_STAT_ADD(skip_list, operations, 1);
+  for (i = skip_list->level; i > 0; --i) {
+    while (x->forward[i - 1].node && r + x->forward[i - 1].width <= rank) {
+      r += x->forward[i - 1].width;
+      x = x->forward[i - 1].node;
+      JRSL_STAT_ADD(skip_list, hops, 1);
+    }
+    update[i - 1] = x;
+    update_rank[i - 1] = r;
+  }
+  return x;
+}
+
+/* Removes the `index`th element of the skip list and returns its data. If
+ * `index` is greater than the width of the skip list, returns NULL. */
+void *jrsl_remove_at(skip_list_t *skip_list, size_t index) {
+  skip_node_t *x;
+  skip_node_t *update[JRSL_MAX_LEVEL];
+  size_t update_rank[JRSL_MAX_LEVEL];
+  void *old;
+
+  JRSL_WRITE_BEGIN(skip_list);
+  if (index >= skip_list->width) {
+    JRSL_WRITE_END(skip_list);
+    return NULL;
+  }
+  x = jrsl_find_rank(skip_list, index, update, update_rank)->forward[0].node;
+  JRSL_LOG(skip_list, JRSL_LOG_REMOVE, x->key, NULL);
+  old = skip_list->deterministic ? jrsl_unlink_123(skip_list, update, x)
+                                 : jrsl_unlink_node(skip_list, update, x);
+  JRSL_WRITE_END(skip_list);
+  return old;
+}
+
+/* Removes the elements of index [lo, hi). Each level is spliced once, only the
+ * removed nodes themselves are walked to free them. */
+static size_t jrsl_remove_span(skip_list_t *skip_list, size_t lo, size_t hi,
+                               node_visitor_t node_visitor) {
+  size_t i, k;
+  skip_node_t *x;
+  /* The node before the next removed one on the snapshot chain */
+  skip_node_t *chain;
+  /* The last node before the span and the last node of the span (or the
+   * node before it) on every level, and their ranks */
+  skip_node_t *left[JRSL_MAX_LEVEL];
+  skip_node_t *right[JRSL_MAX_LEVEL];
+  size_t left_rank[JRSL_MAX_LEVEL];
+  size_t right_rank[JRSL_MAX_LEVEL];
+
+  if (hi > skip_list->width)
+    hi = skip_list->width;
+  if (lo >= hi)
+    return 0;
+  k = hi - lo;
+
+  x = jrsl_find_rank(skip_list, lo, left, left_rank)->forward[0].node;
+  jrsl_find_rank(skip_list, hi, right, right_rank);
+
+  for (i = 0; i < skip_list->level; ++i) {
+    struct link *link = &left[i]->forward[i];
+    if (right[i] == left[i]) {
+      /* No node of the span on this level, the link jumps over it */
+      if (link->node)
+        link->width -= k;
+    } else {
+      skip_node_t *next = right[i]->forward[i].node;
+      link->width = next ? right_rank[i] + right[i]->forward[i].width - k -
+                               left_rank[i]
+                         : 0;
+      JRSL_PUBLISH(link->node, next);
+    }
+    JRSL_AGGREGATE_LINK(skip_list, left[i], i);
+  }
+
+#ifdef JRSL_BACKWARD
+  if (left[0]->forward[0].node)
+    left[0]->forward[0].node->backward =
+        left[0] == skip_list->head ? NULL : left[0];
+#endif
+  if (!left[0]->forward[0].node)
+    skip_list->tail = left[0] == skip_list->head ? NULL : left[0];
+  skip_list->width -= k;
+
+  chain = left[0];
+  for (i = 0; i < k; ++i) {
+    skip_node_t *next = x->forward[0].node;
+    JRSL_LOG(skip_list, JRSL_LOG_REMOVE, x->key, NULL);
+    if (node_visitor)
+      node_visitor(x->key, x->data);
+    chain = jrsl_release_node(skip_list, chain, x);
+    x = next;
+  }
+
+  /* Updates the list's max level */
+  while (skip_list->level > 1 &&
+         !skip_list->head->forward[skip_list->level - 1].node)
+    --skip_list->level;
+
+  return k;
+}
+
+/* Removes the elements of index [lo, hi) and returns their number.
+ * `node_visitor` (if not NULL) is applied to each of them before it is freed,
+ * and must not use the skip list. */
+size_t jrsl_remove_range(skip_list_t *skip_list, size_t lo, size_t hi,
+                         node_visitor_t node_visitor) {
+  size_t count;
+  JRSL_WRITE_BEGIN(skip_list);
+  count = jrsl_remove_span(skip_list, lo, hi, node_visitor);
+  JRSL_WRITE_END(skip_list);
+  return count;
+}
+
+/* Removes the elements whose key is in [lo, hi) and returns their number, see
+ * `jrsl_remove_range`. `lo` may be NULL to start at the first element, and `hi`
+ * NULL to go up to the last one. */
+size_t jrsl_remove_keys(skip_list_t *skip_list, void *lo, void *hi,
+                        node_visitor_t node_visitor) {
+  size_t lo_rank = 0;
+  size_t hi_rank;
+  size_t count;
+
+  JRSL_WRITE_BEGIN(skip_list);
+  hi_rank = skip_list->width;
+  if (lo)
+    jrsl_find_before(skip_list, lo, 0, &lo_rank);
+  if (hi)
+    jrsl_find_before(skip_list, hi, 0, &hi_rank);
+  count = jrsl_remove_span(skip_list, lo_rank, hi_rank, node_visitor);
+  JRSL_WRITE_END(skip_list);
+  return count;
+}
+
+/* Moves the elements of index `index` and above to the empty `right`. The
+ * caller holds the write locks of both lists. */
+static void jrsl_split_nodes(skip_list_t *skip_list, size_t index,
+                             skip_list_t *right) {
+  size_t i;
+  skip_node_t *update[JRSL_MAX_LEVEL];
+  size_t update_rank[JRSL_MAX_LEVEL];
+
+  if (index >= skip_list->width)
+    return;
+
+  jrsl_find_rank(skip_list, index, update, update_rank);
+  JRSL_SNAPSHOT_LINK(right->head, update[0]->forward[0].node);
+  JRSL_SNAPSHOT_LINK(update[0], NULL);
+
+  /* The head of `right` takes over every link crossing the split */
+  for (i = 0; i < skip_list->level; ++i) {
+    struct link *link = &update[i]->forward[i];
+    right->head->forward[i].width =
+        link->node ? update_rank[i] + link->width - index : 0;
+    JRSL_PUBLISH(right->head->forward[i].node, link->node);
+    link->node = NULL;
+    link->width = 0;
+    JRSL_AGGREGATE_LINK(skip_list, right->head, i);
+  }
+
+#ifdef JRSL_BACKWARD
+  right->head->forward[0].node->backward = NULL;
+#endif
+  right->tail = skip_list->tail;
+  skip_list->tail = update[0] == skip_list->head ? NULL : update[0];
+
+  right->level = skip_list->level;
+  right->width = skip_list->width - index;
+  skip_list->width = index;
+
+  /* Updates the lists' max level */
+  while (skip_list->level > 1 &&
+         !skip_list->head->forward[skip_list->level - 1].node)
+    --skip_list->level;
+  while (right->level > 1 && !right->head->forward[right->level - 1].node)
+    --right->level;
+}
+
+/* Moves the elements of index `index` and above to `right`, which must be an
+ * empty skip list. Only the links crossing the split are changed, no node is
+ * copied. Since nodes change lists, both lists must free them the same way. */
+void jrsl_split_at(skip_list_t *skip_list, size_t index, skip_list_t *right) {
+  assert(right->width == 0);
+  JRSL_NO_SNAPSHOT(skip_list);
+  JRSL_NO_SNAPSHOT(right);
+
+  JRSL_WRITE_BEGIN(skip_list);
+  JRSL_WRITE_BEGIN(right);
+  jrsl_reserve(right, 0, skip_list->level);
+  jrsl_split_nodes(skip_list, index, right);
+  JRSL_WRITE_END(right);
+  JRSL_WRITE_END(skip_list);
+}
+
+/* Moves the elements whose key is greater or equal to `key` to `right`, see
+ * `jrsl_split_at`. */
+void jrsl_split_key(skip_list_t *skip_list, void *key, skip_list_t *right) {
+  size_t rank;
+
+  assert(right->width == 0);
+  JRSL_NO_SNAPSHOT(skip_list);
+  JRSL_NO_SNAPSHOT(right);
+
+  JRSL_WRITE_BEGIN(skip_list);
+  JRSL_WRITE_BEGIN(right);
+  jrsl_reserve(right, 0, skip_list->level);
+  jrsl_find_before(skip_list, key, 0, &rank);
+  jrsl_split_nodes(skip_list, rank, right);
+  JRSL_WRITE_END(right);
+  JRSL_WRITE_END(skip_list);
+}
+
+/* Appends the elements of `right` to `left` and empties `right`. The caller
+ * holds the write locks of both lists. */
+static void jrsl_join(skip_list_t *left, skip_list_t *right) {
+  size_t i;
+  skip_node_t *update[JRSL_MAX_LEVEL];
+  size_t update_rank[JRSL_MAX_LEVEL];
+
+  if (right->width == 0)
+    return;
+
+  /* The last node of `left` on every level */
+  jrsl_find_rank(left, left->width, update, update_rank);
+  for (i = left->level; i < right->level; ++i) {
+    update[i] = left->head;
+    update_rank[i] = 0;
+  }
+
+#ifdef JRSL_BACKWARD
+  right->head->forward[0].node->backward = left->tail;
+#endif
+  JRSL_SNAPSHOT_LINK(update[0], right->head->forward[0].node);
+  JRSL_SNAPSHOT_LINK(right->head, NULL);
+
+  for (i = 0; i < right->level; ++i) {
+    struct link *link = &right->head->forward[i];
+    update[i]->forward[i].width =
+        link->node ? left->width - update_rank[i] + link->width : 0;
+    JRSL_PUBLISH(update[i]->forward[i].node, link->node);
+    link->node = NULL;
+    link->width = 0;
+    JRSL_AGGREGATE_LINK(left, update[i], i);
+  }
+
+  if (right->level > left->level)
+    left->level = right->level;
+  left->width += right->width;
+  left->tail = right->tail;
+
+  right->level = 1U;
+  right->width = 0;
+  right->tail = NULL;
+}
+
+/* Appends the elements of `right` to `left`, leaving `right` empty. Every key
+ * of `right` must be greater than the keys of `left`. Only the links crossing
+ * the junction are changed, no node is copied. Since nodes change lists, both
+ * lists must free them the same way. */
+void jrsl_concat(skip_list_t *left, skip_list_t *right) {
+  assert(!left->tail || !right->tail ||
+         left->comparator(left->tail->key,
+                          right->head->forward[0].node->key) < 0);
+  JRSL_NO_SNAPSHOT(left);
+  JRSL_NO_SNAPSHOT(right);
+
+  JRSL_WRITE_BEGIN(left);
+  JRSL_WRITE_BEGIN(right);
+  jrsl_reserve(left, left->width + right->width, right->level);
+  jrsl_join(left, right);
+  JRSL_WRITE_END(right);
+  JRSL_WRITE_END(left);
+}
+
+/* Places a cursor on the first element of the skip list. */
+void jrsl_cursor_init(jrsl_cursor_t *cursor, skip_list_t *skip_list) {
+  size_t i;
+  cursor->skip_list = skip_list;
+  for (i = 0; i < skip_list->max_level; ++i) {
+    cursor->update[i] = skip_list->head;
+    cursor->rank[i] = 0;
+  }
+}
+
+/* Moves the cursor to the first element whose key is not less than `key`.
+ * Returns the data of that element if its key is `key`, NULL otherwise. */
+void *jrsl_cursor_seek(jrsl_cursor_t *cursor, void *key) {
+  skip_list_t *skip_list = cursor->skip_list;
+  size_t i;       /* used in for loops */
+  skip_node_t *x; /* skip node traveler */
+  size_t rank;    /* its rank */
+  /* Whether the node of the path on a level is before the key */
+  char before[JRSL_MAX_LEVEL];
+  skip_node_t *next;
+
+  JRSL_STAT_ADD(skip_list, operations, 1);
+  /* Climbs up the path until a level where the key is between the node of the
+   * path and the next one. That level and the ones above need no update.
+   * Consecutive levels often share nodes, which are only compared once. */
+  for (i = 0; i < skip_list->level; ++i) {
+    if (i > 0 && cursor->update[i] == cursor->update[i - 1])
+      before[i] = before[i - 1];
+    else
+      before[i] = cursor->update[i] == skip_list->head ||
+                  JRSL_CMP(skip_list, cursor->update[i]->key, key) < 0;
+    if (!before[i])
+      continue;
+
+    next = cursor->update[i]->forward[i].node;
+    if (!next)
+      break;
+    /* The same next node was already found before the key one level below */
+    if (i > 0 && before[i - 1] &&
+        next == cursor->update[i - 1]->forward[i - 1].node)
+      continue;
+    if (JRSL_CMP(skip_list, next->key, key) >= 0)
+      break;
+  }
+
+  if (i < skip_list->level) {
+    x = cursor->update[i];
+    rank = cursor->rank[i];
+  } else {
+    x = skip_list->head;
+    rank = 0;
+  }
+
+  /* Walks back down, starting each level from the furthest of the node
+   * reached on the level above and the previous path. */
+  for (; i > 0; --i) {
+    if (before[i - 1] && cursor->rank[i - 1] > rank) {
+      x = cursor->update[i - 1];
+      rank = cursor->rank[i - 1];
+    }
+
+    while (x->forward[i - 1].node != NULL &&
+           JRSL_CMP(skip_list, x->forward[i - 1].node->key, key) < 0) {
+      rank += x->forward[i - 1].width;
+      x = x->forward[i - 1].node;
+      JRSL_STAT_ADD(skip_list, hops, 1);
+    }
+
+    cursor->update[i - 1] = x;
+    cursor->rank[i - 1] = rank;
+  }
+
+  next = cursor->update[0]->forward[0].node;
+  if (next && JRSL_CMP(skip_list, next->key, key) == 0)
+    return next->data;
+  return NULL;
+}
+
+/* Moves the cursor to the element of index `index`, or past the last element
+ * if `index` is greater than the width of the skip list. Returns the data of
+ * that element, NULL if there is none. */
+void *jrsl_cursor_seek_index(jrsl_cursor_t *cursor, size_t index) {
+  skip_list_t *skip_list = cursor->skip_list;
+  size_t i;       /* used in for loops */
+  skip_node_t *x; /* skip node traveler */
+  size_t rank;    /* its rank */
+  skip_node_t *next;
+
+  if (index > skip_list->width)
+    index = skip_list->width;
+
+  JRSL_STAT_ADD(skip_list, operations, 1);
+  /* Climbs up the path until a level where the index is between the node of
+   * the path and the next one. */
+  for (i = 0; i < skip_list->level; ++i) {
+    struct link *link = &cursor->update[i]->forward[i];
+    if (cursor->rank[i] <= index &&
+        (!link->node || cursor->rank[i] + link->width > index))
+      break;
+  }
+
+  if (i < skip_list->level) {
+    x = cursor->update[i];
+    rank = cursor->rank[i];
+  } else {
+    x = skip_list->head;
+    rank = 0;
+  }
+
+  /* Walks back down, starting each level from the furthest of the node
+   * reached on the level above and the previous path. */
+  for (; i > 0; --i) {
+    if (cursor->rank[i - 1] <= index && cursor->rank[i - 1] > rank) {
+      x = cursor->update[i - 1];
+      rank = cursor->rank[i - 1];
+    }
+
+    while (x->forward[i - 1].node != NULL &&
+           rank + x->forward[i - 1].width <= index) {
+      rank += x->forward[i - 1].width;
+      x = x->forward[i - 1].node;
+      JRSL_STAT_ADD(skip_list, hops, 1);
+    }
+
+    cursor->update[i - 1] = x;
+    cursor->rank[i - 1] = rank;
+  }
+
+  next = cursor->update[0]->forward[0].node;
+  if (next)
+    return next->data;
+  return NULL;
+}
+
+/* Moves the cursor to the next element. Returns 0 if there is no such element
+ * and the cursor is now past the last element, 1 otherwise. */
+int jrsl_cursor_next(jrsl_cursor_t *cursor) {
+  size_t i;
+  skip_node_t *x = cursor->update[0]->forward[0].node;
+  size_t rank = cursor->rank[0] + 1;
+
+  if (!x)
+    return 0;
+
+  /* The current node becomes the last node before the position on all of its
+   * levels. */
+  for (i = 0; i < x->level; ++i) {
+    cursor->update[i] = x;
+    cursor->rank[i] = rank;
+  }
+  return x->forward[0].node != NULL;
+}
+
+/* Moves the cursor to the previous element. Returns 0 if the cursor already is
+ * on the first element, 1 otherwise. */
+int jrsl_cursor_prev(jrsl_cursor_t *cursor) {
+  if (cursor->rank[0] == 0)
+    return 0;
+  jrsl_cursor_seek_index(cursor, cursor->rank[0] - 1);
+  return 1;
+}
+
+/* Returns the index of the position of the cursor. */
+size_t jrsl_cursor_index(jrsl_cursor_t *cursor) { return cursor->rank[0]; }
+
+/* Returns the key of the element under the cursor, NULL past the last
+ * element. */
+void *jrsl_cursor_key(jrsl_cursor_t *cursor) {
+  skip_node_t *node = cursor->update[0]->forward[0].node;
+  if (node)
+    return node->key;
+  return NULL;
+}
+
+/* Returns the data of the element under the cursor, NULL past the last
+ * element. */
+void *jrsl_cursor_data(jrsl_cursor_t *cursor) {
+  skip_node_t *node = cursor->update[0]->forward[0].node;
+  if (node)
+    return node->data;
+  return NULL;
+}
+
+#ifdef JRSL_SNAPSHOTS
+/* Opens a snapshot of the skip list in O(1). Until `jrsl_snapshot_close`,
+ * `jrsl_snapshot_first`, `jrsl_snapshot_next` and `jrsl_snapshot_search` see
+ * the elements the list had at this point, whatever writers do in the
+ * meantime: `jrsl_insert`, `jrsl_insert_batch` and the `jrsl_remove` family
+ * may update the list while snapshots are open, the functions rebuilding it
+ * (bulk builds, splits, concatenations, merges, `jrsl_rebalance`) may not.
+ * The keys and data of the elements removed or replaced while the snapshot is
+ * open must stay valid until it is closed. */
+void jrsl_snapshot_open(skip_list_t *skip_list, jrsl_snapshot_t *snapshot) {
+  JRSL_WRITE_BEGIN(skip_list);
+  snapshot->skip_list = skip_list;
+  /* The nodes inserted or removed from now on are stamped with a greater
+   * version */
+  snapshot->version = skip_list->snapshot_version++;
+  snapshot->older = skip_list->newest;
+  snapshot->newer = NULL;
+  if (skip_list->newest)
+    skip_list->newest->newer = snapshot;
+  else
+    skip_list->oldest = snapshot;
+  skip_list->newest = snapshot;
+  JRSL_WRITE_END(skip_list);
+}
+
+/* Takes the removed nodes no open snapshot sees anymore off the snapshot chain,
+ * and retires the nodes off the chain which the open snapshots can't be
+ * walking. The caller holds the write lock. */
+static void jrsl_snapshot_sweep(skip_list_t *skip_list) {
+  skip_node_t **link = &skip_list->dead;
+  skip_node_t *node;
+
+  while ((node = *link) != NULL) {
+    jrsl_snapshot_t *snapshot = skip_list->oldest;
+    skip_node_t *pred;
+    size_t rank;
+
+    while (snapshot && !jrsl_snapshot_sees(snapshot->version, node))
+      snapshot = snapshot->newer;
+    if (snapshot) {
+      link = &node->snapshot_garbage;
+      continue;
+    }
+
+    *link = node->snapshot_garbage;
+    pred = jrsl_find_before(skip_list, node->key, 0, &rank);
+    pred = jrsl_chain_pred(pred, node);
+    JRSL_SNAPSHOT_LINK(pred, node->snapshot_next);
+    /* A snapshot walking the node must still skip it: the birth is stamped
+     * before `jrsl_snapshot_retire` stamps the death */
+    JRSL_PUBLISH(node->birth, skip_list->snapshot_version);
+    jrsl_snapshot_retire(skip_list, node);
+  }
+
+  link = &skip_list->garbage;
+  while ((node = *link) != NULL) {
+    if (skip_list->oldest && skip_list->oldest->version < node->death) {
+      link = &node->snapshot_garbage;
+      continue;
+    }
+    *link = node->snapshot_garbage;
+    jrsl_retire_node(skip_list, node);
+  }
+}
+
+/* Closes a snapshot, the nodes only it was keeping are retired. */
+void jrsl_snapshot_close(jrsl_snapshot_t *snapshot) {
+  skip_list_t *skip_list = snapshot->skip_list;
+
+  JRSL_WRITE_BEGIN(skip_list);
+  if (snapshot->older)
+    snapshot->older->newer = snapshot->newer;
+  else
+    skip_list->oldest = snapshot->newer;
+  if (snapshot->newer)
+    snapshot->newer->older = snapshot->older;
+  else
+    skip_list->newest = snapshot->older;
+  jrsl_snapshot_sweep(skip_list);
+  JRSL_WRITE_END(skip_list);
+}
+
+/* Returns the node of the first element the snapshot sees, NULL if there is
+ * none. Its key and data are the ones of the snapshot. */
+skip_node_t *jrsl_snapshot_first(jrsl_snapshot_t *snapshot) {
+  return jrsl_snapshot_next(snapshot, JRSL_LOAD(snapshot->skip_list->head));
+}
+
+/* Returns the node of the element the snapshot sees after `node`, NULL if
+ * there is none. */
+skip_node_t *jrsl_snapshot_next(jrsl_snapshot_t *snapshot, skip_node_t *node) {
+  do
+    node = JRSL_LOAD(node->snapshot_next);
+  while (node && !jrsl_snapshot_sees(snapshot->version, node));
+  return node;
+}
+
+/* Returns the data the element with the key `key` had when the snapshot was
+ * opened, NULL if there was no such element. The list is searched for the
+ * node before it, from which the snapshot chain is followed. */
+void *jrsl_snapshot_search(jrsl_snapshot_t *snapshot, void *key) {
+  skip_list_t *skip_list = snapshot->skip_list;
+  skip_node_t *x;
+  size_t rank;
+  unsigned long version;
+  char cmp;
+
+  do {
+    version = JRSL_READ_BEGIN(skip_list);
+    x = jrsl_find_before(skip_list, key, 0, &rank);
+  } while (JRSL_READ_RETRY(skip_list, version));
+
+  /* The node may be removed since, but not freed while the snapshot is open */
+  while ((x = JRSL_LOAD(x->snapshot_next)) != NULL &&
+         (cmp = JRSL_CMP(skip_list, x->key, key)) <= 0) {
+    if (cmp == 0 && jrsl_snapshot_sees(snapshot->version, x))
+      return x->data;
+  }
+  return NULL;
+}
+#endif
+
+/* State of a linear build of the skip list, nodes are appended in order. */
+struct jrsl_builder_t {
+  /* The list being built */
+  skip_list_t *skip_list;
+
+  /* The last node linked on each level and its rank (the head has rank 0) */
+  skip_node_t *last[JRSL_MAX_LEVEL];
+  size_t rank[JRSL_MAX_LEVEL];
+
+  size_t width;
+  unsigned short level;
+};
+
+/* Starts building the (empty) skip list. */
+static void jrsl_builder_begin(skip_list_t *skip_list,
+                               struct jrsl_builder_t *builder) {
+  size_t i;
+  builder->skip_list = skip_list;
+  for (i = 0; i < skip_list->max_level; ++i) {
+    builder->last[i] = skip_list->head;
+    builder->rank[i] = 0;
+  }
+  builder->width = 0;
+  builder->level = 1;
+}
+
+/* Appends a node after every node already appended. Its key must be greater
+ * than theirs. */
+static void jrsl_builder_append(struct jrsl_builder_t *builder,
+                                skip_node_t *node) {
+  size_t i;
+  size_t rank = ++builder->width;
+
+#ifdef JRSL_BACKWARD
+  node->backward = builder->rank[0] ? builder->last[0] : NULL;
+#endif
+  JRSL_SNAPSHOT_LINK(node, NULL);
+  JRSL_SNAPSHOT_LINK(builder->last[0], node);
+
+  for (i = 0; i < node->level; ++i) {
+    /* The node ends every level until the next one is appended */
+    node->forward[i].node = NULL;
+    node->forward[i].width = 0;
+    JRSL_PUBLISH(builder->last[i]->forward[i].node, node);
+    builder->last[i]->forward[i].width = rank - builder->rank[i];
+    JRSL_AGGREGATE_LINK(builder->skip_list, builder->last[i], i);
+    builder->last[i] = node;
+    builder->rank[i] = rank;
+  }
+
+  if (node->level > builder->level)
+    builder->level = node->level;
+}
+
+/* Terminates every level and stores the result in the skip list. */
+static void jrsl_builder_end(skip_list_t *skip_list,
+                             struct jrsl_builder_t *builder) {
+  size_t i;
+  for (i = 0; i < builder->level; ++i) {
+    /* The width to NULL is always 0 */
+    builder->last[i]->forward[i].node = NULL;
+    builder->last[i]->forward[i].width = 0;
+  }
+  JRSL_SNAPSHOT_LINK(builder->last[0], NULL);
+  skip_list->level = builder->level;
+  skip_list->width = builder->width;
+  skip_list->tail = builder->width ? builder->last[0] : NULL;
+}
+
+/* Returns the level of the node of rank `rank` (starting at 1) in a perfectly
+ * balanced skip list: every 1/p-th node of a level is promoted to the next
+ * one. */
+static unsigned short jrsl_balanced_level(skip_list_t *skip_list,
+                                          size_t rank) {
+  /* Number of nodes of a level between two nodes of the level above */
+  size_t step = (size_t)(1 / skip_list->p + 0.5f);
+  unsigned short level = 1;
+
+  if (step < 2)
+    step = 2;
+  while (rank % step == 0 && level < skip_list->max_level - 1) {
+    rank /= step;
+    level++;
+  }
+  return level;
+}
+
+/* Appends `n` nodes to the builder, `first` being the index of the first one
+ * in the final list. */
+static void jrsl_build_nodes(skip_list_t *skip_list,
+                             struct jrsl_builder_t *builder, void **keys,
+                             void **data, size_t first, size_t n) {
+  size_t i;
+  for (i = first; i < first + n; ++i) {
+    skip_node_t *node =
+        jrsl_alloc_node(skip_list, jrsl_balanced_level(skip_list, i + 1));
+    node->key = keys[i];
+    node->data = data ? data[i] : NULL;
+    jrsl_builder_append(builder, node);
+  }
+}
+
+/* Merges `b` into `a` in a single pass over both lists, reusing their nodes.
+ * The caller holds the write locks of both lists. */
+static void jrsl_merge_nodes(skip_list_t *a, skip_list_t *b,
+                             merge_policy_t policy) {
+  size_t i;
+  struct jrsl_builder_t builder;
+  skip_node_t *x = a->head->forward[0].node;
+  skip_node_t *y = b->head->forward[0].node;
+
+  if (!y)
+    return;
+
+  jrsl_builder_begin(a, &builder);
+  while (x || y) {
+    skip_node_t *node;
+    char c = !x ? 1 : !y ? -1 : JRSL_CMP(a, x->key, y->key);
+
+    /* The next nodes are read first, appending a node clears its links */
+    if (c < 0) {
+      node = x;
+      x = x->forward[0].node;
+    } else if (c > 0) {
+      node = y;
+      y = y->forward[0].node;
+    } else {
+      skip_node_t *duplicate = y;
+      node = x;
+      x = x->forward[0].node;
+      y = y->forward[0].node;
+      node->data = policy ? policy(node->key, node->data, duplicate->key,
+                                   duplicate->data)
+                          : duplicate->data;
+      jrsl_retire_node(b, duplicate);
+    }
+    jrsl_builder_append(&builder, node);
+  }
+  jrsl_builder_end(a, &builder);
+
+  for (i = 0; i < b->level; ++i) {
+    b->head->forward[i].node = NULL;
+    b->head->forward[i].width = 0;
+  }
+  JRSL_SNAPSHOT_LINK(b->head, NULL);
+  b->level = 1U;
+  b->width = 0;
+  b->tail = NULL;
+}
+
+#ifdef JRSL_THREADS
+/* Runs the `n` tasks of the array `tasks`, the first one in the calling thread.
+ * A task whose thread can't be created runs in the calling thread too. */
+static void jrsl_run_tasks(void *(*run)(void *), void *tasks, size_t size,
+                           size_t n) {
+  size_t i;
+  pthread_t threads[JRSL_THREADS];
+  char started[JRSL_THREADS];
+
+  for (i = 1; i < n; ++i)
+    started[i] =
+        pthread_create(&threads[i], NULL, run, (char *)tasks + i * size) == 0;
+  run(tasks);
+  for (i = 1; i < n; ++i) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      run((char *)tasks + i * size);
+  }
+}
+
+/* Initializes an empty skip list with the same parameters as `model`. */
+static void jrsl_initialize_like(skip_list_t *skip_list, skip_list_t *model) {
+  jrsl_initialize(skip_list, model->comparator, model->key_destructor,
+                  model->p, model->max_level);
+#ifdef JRSL_AGGREGATE
+  skip_list->aggregator = model->aggregator;
+#endif
+}
+
+#ifdef JRSL_OPTIMISTIC
+/* Moves the nodes retired by `other` to the ones of `skip_list`. */
+static void jrsl_adopt_retired(skip_list_t *skip_list, skip_list_t *other) {
+  skip_node_t *node = other->retired;
+  if (!node)
+    return;
+  while (node->data)
+    node = (skip_node_t *)node->data;
+  node->data = skip_list->retired;
+  skip_list->retired = other->retired;
+  other->retired = NULL;
+}
+#endif
+
+/* A slice of the input of `jrsl_build_sorted`, built as its own list */
+struct jrsl_build_task_t {
+  skip_list_t list;
+  void **keys;
+  void **data;
+  size_t first;
+  size_t n;
+};
+
+static void *jrsl_build_task(void *arg) {
+  struct jrsl_build_task_t *task = (struct jrsl_build_task_t *)arg;
+  struct jrsl_builder_t builder;
+
+  jrsl_builder_begin(&task->list, &builder);
+  jrsl_build_nodes(&task->list, &builder, task->keys, task->data, task->first,
+                   task->n);
+  jrsl_builder_end(&task->list, &builder);
+  return NULL;
+}
+
+/* Builds one list per thread and joins them. The levels only depend on the
+ * index, so the result is the same as the one of a single thread. */
+static void jrsl_build_parallel(skip_list_t *skip_list, void **keys,
+                                void **data, size_t n) {
+  size_t i;
+  struct jrsl_build_task_t tasks[JRSL_THREADS];
+  size_t slice = n / JRSL_THREADS;
+
+  for (i = 0; i < JRSL_THREADS; ++i) {
+    jrsl_initialize_like(&tasks[i].list, skip_list);
+    tasks[i].keys = keys;
+    tasks[i].data = data;
+    tasks[i].first = i * slice;
+    tasks[i].n = i + 1 < JRSL_THREADS ? slice : n - i * slice;
+  }
+  jrsl_run_tasks(jrsl_build_task, tasks, sizeof(struct jrsl_build_task_t),
+                 JRSL_THREADS);
+  for (i = 0; i < JRSL_THREADS; ++i) {
+    jrsl_join(skip_list, &tasks[i].list);
+    jrsl_destroy(&tasks[i].list, NULL);
+  }
+}
+
+/* A key range of the lists given to `jrsl_merge` */
+struct jrsl_merge_task_t {
+  skip_list_t *a;
+  skip_list_t *b;
+  skip_list_t part_a;
+  skip_list_t part_b;
+  merge_policy_t policy;
+};
+
+static void *jrsl_merge_task(void *arg) {
+  struct jrsl_merge_task_t *task = (struct jrsl_merge_task_t *)arg;
+  jrsl_merge_nodes(task->a, task->b, task->policy);
+  return NULL;
+}
+
+/* Splits both lists at the same keys of `a`, merges each range in its thread
+ * and joins the results. */
+static void jrsl_merge_parallel(skip_list_t *a, skip_list_t *b,
+                                merge_policy_t policy) {
+  size_t i;
+  struct jrsl_merge_task_t tasks[JRSL_THREADS];
+  size_t width = a->width;
+
+  /* Splitting from the end keeps the indexes of the pivots valid */
+  for (i = JRSL_THREADS - 1; i > 0; --i) {
+    struct jrsl_merge_task_t *task = &tasks[i];
+    size_t index = i * width / JRSL_THREADS;
+    size_t rank;
+
+    jrsl_initialize_like(&task->part_a, a);
+    jrsl_initialize_like(&task->part_b, b);
+    jrsl_find_before(b, jrsl_node_at(a, index)->key, 0, &rank);
+    jrsl_split_nodes(a, index, &task->part_a);
+    jrsl_split_nodes(b, rank, &task->part_b);
+    task->a = &task->part_a;
+    task->b = &task->part_b;
+    task->policy = policy;
+  }
+  tasks[0].a = a;
+  tasks[0].b = b;
+  tasks[0].policy = policy;
+
+  jrsl_run_tasks(jrsl_merge_task, tasks, sizeof(struct jrsl_merge_task_t),
+                 JRSL_THREADS);
+  for (i = 1; i < JRSL_THREADS; ++i) {
+    jrsl_join(a, &tasks[i].part_a);
+#ifdef JRSL_OPTIMISTIC
+    jrsl_adopt_retired(b, &tasks[i].part_b);
+#endif
+    jrsl_destroy(&tasks[i].part_a, NULL);
+    jrsl_destroy(&tasks[i].part_b, NULL);
+  }
+}
+#endif /*JRSL_THREADS*/
+
+/* Fills an empty skip list with `n` elements whose keys are sorted in strictly
+ * increasing order, in a single pass and without calling the comparator. The
+ * levels are not random: the list is perfectly balanced. `data` may be NULL, in
+ * which case all the data is NULL. */
+void jrsl_build_sorted(skip_list_t *skip_list, void **keys, void **data,
+                       size_t n) {
+  struct jrsl_builder_t builder;
+
+  assert(skip_list->width == 0);
+  JRSL_NO_SNAPSHOT(skip_list);
+
+  JRSL_WRITE_BEGIN(skip_list);
+  jrsl_reserve(skip_list, n, 0);
+#ifdef JRSL_THREADS
+  if (n >= JRSL_PARALLEL_MIN &&
+      skip_list->allocator.alloc == jrsl_default_alloc) {
+    jrsl_build_parallel(skip_list, keys, data, n);
+    JRSL_WRITE_END(skip_list);
+    return;
+  }
+#endif
+  jrsl_builder_begin(skip_list, &builder);
+  jrsl_build_nodes(skip_list, &builder, keys, data, 0, n);
+  jrsl_builder_end(skip_list, &builder);
+  JRSL_WRITE_END(skip_list);
+}
+
+/* Moves every element of `b` to `a`, leaving `b` empty, in a single pass over
+ * both lists which reuses their nodes. When a key is in both lists, the node of
+ * `a` is kept with the data returned by `policy` (or the data of `b` if
+ * `policy` is NULL), and the node of `b` is freed: `policy` may free its key.
+ * With `JRSL_THREADS`, `policy` may be called by several threads at once.
+ * When every key of `b` is greater than the keys of `a`, this is
+ * `jrsl_concat`. */
+void jrsl_merge(skip_list_t *a, skip_list_t *b, merge_policy_t policy) {
+  JRSL_NO_SNAPSHOT(a);
+  JRSL_NO_SNAPSHOT(b);
+
+  JRSL_WRITE_BEGIN(a);
+  JRSL_WRITE_BEGIN(b);
+  jrsl_reserve(a, a->width + b->width, b->level);
+  if (!a->tail ||
+      (b->tail && JRSL_CMP(a, a->tail->key, b->head->forward[0].node->key) < 0))
+    jrsl_join(a, b);
+#ifdef JRSL_THREADS
+  else if (a->width + b->width >= JRSL_PARALLEL_MIN &&
+           a->width >= JRSL_THREADS &&
+           a->allocator.alloc == jrsl_default_alloc &&
+           b->allocator.alloc == jrsl_default_alloc)
+    jrsl_merge_parallel(a, b, policy);
+#endif
+  else
+    jrsl_merge_nodes(a, b, policy);
+  JRSL_WRITE_END(b);
+  JRSL_WRITE_END(a);
+}
 
-  /* Helper array of pointers to elements that will need updating. */
-  skip_node_t **update =
-      (skip_node_t **)malloc(skip_list->max_level * sizeof(skip_node_t *));
+/* Gives the elements of index `start` to `start + count - 1` the levels they
+ * would have in a perfectly balanced skip list (see `jrsl_build_sorted`), in
+ * O(log n + count) and without calling the comparator. Only the nodes whose
+ * level changes are reallocated. Returns the index following the last element
+ * re-leveled, so that a list can be rebalanced by small steps between other
+ * operations, for instance when the level histogram of `jrsl_stats_snapshot`
+ * is skewed or after `max_level` grew. */
+size_t jrsl_rebalance(skip_list_t *skip_list, size_t start, size_t count) {
+  size_t i, end;
+  struct jrsl_builder_t builder;
+  skip_node_t *x; /* skip node traveler */
+  /* The first node after the elements on each level and its rank */
+  skip_node_t *next[JRSL_MAX_LEVEL];
+  size_t next_rank[JRSL_MAX_LEVEL];
+  unsigned short level;
 
-  /* Helper array to update widths. */
-  size_t *update_width =
-      (size_t *)malloc(skip_list->max_level * sizeof(size_t));
+  JRSL_NO_SNAPSHOT(skip_list);
 
-  if (!update || !update_width) {
-    /* Malloc Failure */
-    exit(EXIT_FAILURE);
+  JRSL_WRITE_BEGIN(skip_list);
+  if (start >= skip_list->width) {
+    JRSL_WRITE_END(skip_list);
+    return skip_list->width;
   }
+  end = count < skip_list->width - start ? start + count : skip_list->width;
 
-  /* Finds the correct spot for the key in the skip list. */
-  x = skip_list->head;
-  for (i = skip_list->level; i > 0; --i) {
-    /* The sum of traveled widths. */
-    size_t width_sum = 0;
-
-    while (x->forward[i - 1].node != NULL &&
-           skip_list->comparator(x->forward[i - 1].node->key, key) < 0) {
-      width_sum += x->forward[i - 1].width;
-      x = x->forward[i - 1].node;
+  jrsl_find_rank(skip_list, end, next, next_rank);
+  for (i = 0; i < skip_list->max_level; ++i) {
+    if (i < skip_list->level && next[i]->forward[i].node) {
+      next_rank[i] += next[i]->forward[i].width;
+      next[i] = next[i]->forward[i].node;
+    } else {
+      next[i] = NULL;
     }
-
-    update[i - 1] = x;
-    update_width[i - 1] = width_sum;
   }
 
-  /* If the node is already in the list, retuns the already existing node. */
-  if (x->forward[0].node) {
-    if (skip_list->comparator(x->forward[0].node->key, key) == 0) {
-      void *old = x->forward[0].node->data;
-      x->forward[0].node->data = data;
+  /* Appends the elements again after the nodes before them */
+  builder.skip_list = skip_list;
+  x = jrsl_find_rank(skip_list, start, builder.last, builder.rank);
+  for (i = skip_list->level; i < skip_list->max_level; ++i) {
+    builder.last[i] = skip_list->head;
+    builder.rank[i] = 0;
+  }
+  builder.width = start;
+  builder.level = skip_list->level;
 
-      free(update);
-      free(update_width);
-      return old;
+  x = x->forward[0].node;
+  for (i = start; i < end; ++i) {
+    skip_node_t *node = x;
+    /* The next node is read first, appending a node clears its links */
+    x = x->forward[0].node;
+    level = jrsl_balanced_level(skip_list, i + 1);
+    if (node->level != level) {
+      skip_node_t *old = node;
+      node = jrsl_alloc_node(skip_list, level);
+      node->key = old->key;
+      node->data = old->data;
+      jrsl_retire_node(skip_list, old);
     }
+    jrsl_builder_append(&builder, node);
   }
 
-  /* The level for the new node. */
-  level = jrsl_random_level(skip_list);
+  /* Links the last nodes appended on each level to the rest of the list */
+  level = builder.level > skip_list->level ? builder.level : skip_list->level;
+  for (i = 0; i < level; ++i) {
+    builder.last[i]->forward[i].width =
+        next[i] ? next_rank[i] - builder.rank[i] : 0;
+    JRSL_PUBLISH(builder.last[i]->forward[i].node, next[i]);
+    JRSL_AGGREGATE_LINK(skip_list, builder.last[i], i);
+  }
+  JRSL_SNAPSHOT_LINK(builder.last[0], next[0]);
+#ifdef JRSL_BACKWARD
+  if (next[0])
+    next[0]->backward = builder.last[0];
+#endif
+  if (!next[0])
+    skip_list->tail = builder.last[0];
 
-  /* sanity check */
-  assert(level < skip_list->max_level);
+  while (level > 1 && !skip_list->head->forward[level - 1].node)
+    --level;
+  skip_list->level = level;
+  JRSL_WRITE_END(skip_list);
+  return end;
+}
 
-  /*  Completes the helper arrays if the new node is the first node on a (new)
-   * level.*/
-  if (level > skip_list->level) {
-    size_t i;
-    for (i = skip_list->level; i < level; ++i) {
-      update[i] = skip_list->head;
-      update_width[i] = 0;
+static unsigned short jrsl_random_level(skip_list_t *skip_list) {
+  return jrsl_draw_level(&skip_list->rng, skip_list->max_level);
+}
 
-      /* The width to NULL is always 0 */
-      skip_list->head->forward[i].node = NULL;
-      skip_list->head->forward[i].width = 0;
-    }
-    skip_list->level = level;
-  }
+/* Start of a serialized skip list: the magic, the format version, the flags
+ * and the number of elements as 8 little endian bytes. */
+#define JRSL_SERIAL_MAGIC "jrsl"
+#define JRSL_SERIAL_VERSION 1
+#define JRSL_SERIAL_LEVELS 1
+#define JRSL_SERIAL_HEADER 14
 
-  new_node = (skip_node_t *)malloc(sizeof(skip_node_t));
+/* Writes the elements of the skip list in order with `codec->encode`, after a
+ * short header. If `levels` is not 0, the level of every node is written (one
+ * byte) before it, so that the list can be loaded with the same structure,
+ * otherwise it is loaded perfectly balanced. Returns 0, or the first non zero
+ * value returned by the codec. Writers must be kept out. */
+int jrsl_serialize(skip_list_t *skip_list, const jrsl_codec_t *codec,
+                   char levels) {
+  int result;
+  size_t i;
+  unsigned char header[JRSL_SERIAL_HEADER];
+  jrsl_u64_t width = skip_list->width;
+  skip_node_t *x = skip_list->head->forward[0].node;
 
-  if (!new_node) {
-    /* Malloc Failure */
-    exit(EXIT_FAILURE);
+  memcpy(header, JRSL_SERIAL_MAGIC, 4);
+  header[4] = JRSL_SERIAL_VERSION;
+  header[5] = levels ? JRSL_SERIAL_LEVELS : 0;
+  for (i = 0; i < 8; ++i)
+    header[6 + i] = (unsigned char)(width >> (8 * i));
+  if ((result = codec->write(codec->context, header, sizeof(header))) != 0)
+    return result;
+
+  for (; x; x = x->forward[0].node) {
+    if (levels) {
+      unsigned char level = (unsigned char)x->level;
+      if ((result = codec->write(codec->context, &level, 1)) != 0)
+        return result;
+    }
+    if ((result = codec->encode(codec, x->key, x->data)) != 0)
+      return result;
   }
+  return 0;
+}
 
-  new_node->data = data;
-  new_node->key = key;
-  new_node->forward = (struct link *)malloc(level * sizeof(struct link));
+/* Loads an empty skip list from the output of `jrsl_serialize`, decoding the
+ * elements with `codec->decode`. The elements are appended in a single pass,
+ * without calling the comparator, and levels above the max level of the list
+ * are lowered. Returns 0, -1 if the header is invalid, or the first non zero
+ * value returned by the codec, in which case the list holds the elements read
+ * so far. */
+int jrsl_deserialize(skip_list_t *skip_list, const jrsl_codec_t *codec) {
+  int result;
+  size_t i;
+  unsigned char header[JRSL_SERIAL_HEADER];
+  jrsl_u64_t width = 0;
+  jrsl_u64_t n;
+  struct jrsl_builder_t builder;
 
-  if (!new_node->forward) {
-    /* Malloc Failure */
-    exit(EXIT_FAILURE);
-  }
+  assert(skip_list->width == 0);
+  JRSL_NO_SNAPSHOT(skip_list);
 
-  /* Inserts the new node in the list. */
-  for (i = 0; i < level; ++i) {
-    /* Update the linked nodes. */
-    new_node->forward[i].node = update[i]->forward[i].node;
-    update[i]->forward[i].node = new_node;
-
-    /* Updates the widths of the links. */
-    if (i > 0) {
-      size_t width_before =
-          update_width[i - 1] + update[i - 1]->forward[i - 1].width;
-
-      if (update[i]->forward[i].width > 0)
-        /* The width is the width of the previous connection, + 1 ( because we
-         * are inserting a node ) - whatever is before the new node.
-         */
-        new_node->forward[i].width =
-            update[i]->forward[i].width + 1 - width_before;
-      else
-        /* The width to NULL is always 0. */
-        new_node->forward[i].width = 0;
+  if ((result = codec->read(codec->context, header, sizeof(header))) != 0)
+    return result;
+  if (memcmp(header, JRSL_SERIAL_MAGIC, 4) != 0 ||
+      header[4] != JRSL_SERIAL_VERSION || (header[5] & ~JRSL_SERIAL_LEVELS))
+    return -1;
+  for (i = 0; i < 8; ++i)
+    width |= (jrsl_u64_t)header[6 + i] << (8 * i);
 
-      update[i]->forward[i].width = width_before;
-    } else { /* i == 0 */
-      new_node->forward[i].width = update[i]->forward[i].width;
-      update[i]->forward[i].width = 1;
-    }
-  }
+  JRSL_WRITE_BEGIN(skip_list);
+  jrsl_reserve(skip_list, width < (size_t)-1 ? (size_t)width : (size_t)-1, 0);
+  jrsl_builder_begin(skip_list, &builder);
+  for (n = 0; n < width; ++n) {
+    unsigned short level;
+    void *key;
+    void *data;
+    skip_node_t *node;
 
-  /* Updates the widths of the links above the newly created node. */
-  for (i = level; i < skip_list->level; ++i) {
-    if (update[i]->forward[i].node)
-      ++update[i]->forward[i].width;
-    else
-      /* The width to NULL is always 0 and does not need updating. All links
-       * above a link pointing to NULL will point to NULL. */
+    if (header[5] & JRSL_SERIAL_LEVELS) {
+      unsigned char stored;
+      if ((result = codec->read(codec->context, &stored, 1)) != 0)
+        break;
+      level = stored;
+      if (level >= skip_list->max_level)
+        level = skip_list->max_level - 1;
+      if (level < 1)
+        level = 1;
+    } else {
+      level = jrsl_balanced_level(skip_list, (size_t)n + 1);
+    }
+    if ((result = codec->decode(codec, &key, &data)) != 0)
       break;
+
+    node = jrsl_alloc_node(skip_list, level);
+    node->key = key;
+    node->data = data;
+    jrsl_builder_append(&builder, node);
   }
+  jrsl_builder_end(skip_list, &builder);
+  JRSL_WRITE_END(skip_list);
+  return result;
+}
 
-  skip_list->width++;
+/* `jrsl_write_t` and `jrsl_read_t` for a `FILE *` context. */
+int jrsl_file_write(void *context, const void *buffer, size_t size) {
+  return fwrite(buffer, 1, size, (FILE *)context) != size;
+}
 
-  free(update);
-  free(update_width);
-  return NULL;
+int jrsl_file_read(void *context, void *buffer, size_t size) {
+  return fread(buffer, 1, size, (FILE *)context) != size;
 }
 
-/* Removes an element from the skip list and returns its data. If it's not
- * in the list returns NULL. */
-void *jrsl_remove(skip_list_t *skip_list, void *key) {
-  size_t i;       /*used  in for loops */
-  skip_node_t *x; /* A skip node traveler */
-  void *old;      /* A pointer to the node we will remove */
-  /* Helper array of pointers to elements that will need updating. */
-  skip_node_t **update =
-      (skip_node_t **)malloc(skip_list->level * sizeof(skip_node_t *));
+#ifdef JRSL_WAL
+/* Copies `size` bytes to the log buffer, writing it out first when they don't
+ * fit. */
+static int jrsl_log_append(void *context, const void *buffer, size_t size) {
+  jrsl_log_t *log = (jrsl_log_t *)context;
 
-  if (!update) {
-    /* Malloc Failure */
-    exit(EXIT_FAILURE);
+  if (size > log->size - log->used && jrsl_log_flush(log) != 0)
+    return log->error;
+  if (size > log->size) {
+    int result = log->sink.write(log->sink.context, buffer, size);
+    if (result && !log->error)
+      log->error = result;
+    return result;
   }
+  memcpy(log->buffer + log->used, buffer, size);
+  log->used += size;
+  return 0;
+}
 
-  /* Finds the theoretical location of the key. */
-  x = skip_list->head;
-  for (i = skip_list->level; i > 0; --i) {
-    while (x->forward[i - 1].node != NULL &&
-           skip_list->comparator(x->forward[i - 1].node->key, key) < 0) {
-      x = x->forward[i - 1].node;
-    }
-    update[i - 1] = x;
-  }
-  x = x->forward[0].node;
+static void jrsl_log_record(jrsl_log_t *log, unsigned char op, void *key,
+                            void *data) {
+  int result = jrsl_log_append(log, &op, 1);
+  if (!result)
+    result = log->codec.encode(&log->codec, key, data);
+  if (result && !log->error)
+    log->error = result;
+}
 
-  /* Could not find the key in the skip list. */
-  if (skip_list->comparator(x->key, key) != 0) {
-    free(update);
-    return NULL;
+/* Initializes a log of `size` bytes writing to the stream of `codec` with
+ * `codec->write`, the elements being written with `codec->encode`. */
+void jrsl_log_init(jrsl_log_t *log, size_t size, const jrsl_codec_t *codec) {
+  log->buffer = (unsigned char *)malloc(size);
+  if (!log->buffer)
+    exit(EXIT_FAILURE);
+  log->size = size;
+  log->used = 0;
+  log->sink = *codec;
+  log->codec = *codec;
+  log->codec.write = jrsl_log_append;
+  log->codec.context = log;
+  log->error = 0;
+}
+
+/* Writes out the records buffered so far, in a single call to the stream: a
+ * group of updates is committed at once. Returns 0, or the first error met by
+ * the log since it was initialized. The writers of the lists using the log
+ * must be kept out. */
+int jrsl_log_flush(jrsl_log_t *log) {
+  if (log->used) {
+    int result = log->sink.write(log->sink.context, log->buffer, log->used);
+    if (result && !log->error)
+      log->error = result;
+    log->used = 0;
   }
+  return log->error;
+}
 
-  /* TODO * /
-  /* Updates the list and removes the node */
-  for (i = 0; i < skip_list->level; ++i) {
-    if (update[i]->forward[i].node) {
-      if (skip_list->comparator(update[i]->forward[i].node->key, key) == 0) {
-        update[i]->forward[i].node = x->forward[i].node;
+/* Frees the buffer of the log, without flushing it. */
+void jrsl_log_destroy(jrsl_log_t *log) { free(log->buffer); }
 
-        if (x->forward[i].width > 0)
-          update[i]->forward[i].width += x->forward[i].width - 1;
-        else
-          update[i]->forward[i].width = 0;
-        continue;
-      } else {
-        --update[i]->forward[i].width;
+/* Starts logging the updates of the skip list to `log`, or stops if `log` is
+ * NULL. Each record is an operation byte followed by the element written by
+ * the encoder (the data of removals is NULL). `jrsl_build_sorted`, splits,
+ * concatenations, merges and deserializations are not logged, a snapshot
+ * should be taken after them. */
+void jrsl_set_log(skip_list_t *skip_list, jrsl_log_t *log) {
+  skip_list->log = log;
+}
+
+/* Sorts a replay batch by key with a stable merge sort, so that the last
+ * update of a key stays the last one. */
+static void jrsl_sort_batch(skip_list_t *skip_list, void **keys, void **data,
+                            void **tmp_keys, void **tmp_data, size_t n) {
+  size_t width, i;
+  for (width = 1; width < n; width *= 2) {
+    for (i = 0; i < n; i += 2 * width) {
+      size_t a = i, mid = i + width < n ? i + width : n;
+      size_t b = mid, end = i + 2 * width < n ? i + 2 * width : n;
+      size_t k = i;
+      while (a < mid || b < end) {
+        if (b >= end ||
+            (a < mid && JRSL_CMP(skip_list, keys[a], keys[b]) <= 0)) {
+          tmp_keys[k] = keys[a];
+          tmp_data[k++] = data[a++];
+        } else {
+          tmp_keys[k] = keys[b];
+          tmp_data[k++] = data[b++];
+        }
       }
     }
+    memcpy(keys, tmp_keys, n * sizeof(void *));
+    memcpy(data, tmp_data, n * sizeof(void *));
   }
+}
 
-  free(update);
+/* Applies a batch of insertions, a decoded key which isn't kept by the list
+ * goes to its key destructor. */
+static void jrsl_replay_batch(skip_list_t *skip_list, void **keys, void **data,
+                              size_t n) {
+  void *tmp_keys[JRSL_REPLAY_BATCH];
+  void *tmp_data[JRSL_REPLAY_BATCH];
+  char found[JRSL_REPLAY_BATCH];
+  size_t i, m = 0;
 
-  old = x->data;
-  free(x->forward);
-  free(x);
+  jrsl_sort_batch(skip_list, keys, data, tmp_keys, tmp_data, n);
 
-  /* Updates the list's max level */
-  while (skip_list->level > 1 &&
-         !skip_list->head->forward[skip_list->level - 1].node)
-    --skip_list->level;
+  /* Only the last update of every key is kept */
+  for (i = 0; i < n; ++i) {
+    if (i + 1 < n && JRSL_CMP(skip_list, keys[i], keys[i + 1]) == 0) {
+      if (skip_list->key_destructor)
+        skip_list->key_destructor(keys[i]);
+      continue;
+    }
+    keys[m] = keys[i];
+    data[m++] = data[i];
+  }
 
-  return old;
+  jrsl_insert_sorted(skip_list, keys, data, m, NULL, found);
+  if (skip_list->key_destructor)
+    for (i = 0; i < m; ++i)
+      if (found[i])
+        skip_list->key_destructor(keys[i]);
 }
 
-static unsigned short jrsl_random_level(skip_list_t *skip_list) {
-  /* We don't actually care about initialization */
-  float rnd = rand() / (float)RAND_MAX;
-  size_t level = 1;
-  while (rnd < skip_list->p && level < skip_list->max_level - 1) {
-    level++;
-    rnd = rand() / (float)RAND_MAX;
+/* Applies the records read from the stream of `codec` with `codec->read` and
+ * `codec->decode`, in order, until one can't be read (the end of the log, or a
+ * record torn by a crash). Consecutive insertions are applied in sorted
+ * batches with `jrsl_insert_batch`. The keys are expected to come from the
+ * decoder, like the ones of the snapshot: keys dropped by the list (the ones of
+ * removals, of updates and of the removed elements) are given to its key
+ * destructor, if any. Returns the number of records applied. The updates
+ * replayed are not logged again. */
+size_t jrsl_replay(skip_list_t *skip_list, const jrsl_codec_t *codec) {
+  void *keys[JRSL_REPLAY_BATCH];
+  void *data[JRSL_REPLAY_BATCH];
+  size_t n = 0;
+  size_t count = 0;
+  jrsl_log_t *log = skip_list->log;
+
+  skip_list->log = NULL;
+  for (;;) {
+    unsigned char op;
+    void *key;
+    void *value;
+
+    if (codec->read(codec->context, &op, 1) != 0 ||
+        (op != JRSL_LOG_INSERT && op != JRSL_LOG_REMOVE) ||
+        codec->decode(codec, &key, &value) != 0)
+      break;
+    ++count;
+
+    if (op == JRSL_LOG_INSERT) {
+      keys[n] = key;
+      data[n++] = value;
+      if (n == JRSL_REPLAY_BATCH) {
+        jrsl_replay_batch(skip_list, keys, data, n);
+        n = 0;
+      }
+      continue;
+    }
+
+    /* The insertions before the removal are applied first */
+    if (n) {
+      jrsl_replay_batch(skip_list, keys, data, n);
+      n = 0;
+    }
+    if (skip_list->key_destructor) {
+      skip_node_t *node = jrsl_lower_bound(skip_list, key, NULL);
+      if (node && JRSL_CMP(skip_list, node->key, key) == 0) {
+        void *removed = node->key;
+        jrsl_remove(skip_list, key);
+        skip_list->key_destructor(removed);
+      }
+      skip_list->key_destructor(key);
+    } else {
+      jrsl_remove(skip_list, key);
+    }
   }
-  return level;
+  if (n)
+    jrsl_replay_batch(skip_list, keys, data, n);
+
+  skip_list->log = log;
+  return count;
 }
+#endif /*JRSL_WAL*/
 
 /* Returns the optimal max level based on the probability `p` to add a new
- * level and the estimated maximum number of elements `N`.
+ * level and the estimated maximum number of elements `N`, capped at
+ * `JRSL_MAX_LEVEL`. The max level of a list still grows if it gets larger.
  * If `p` is invalid (p > 1 || p < 0) returns 0 */
 unsigned short jrsl_max_level(size_t N, float p) {
+  size_t level;
   if (!(0 <= p <= 1))
     return 0;
-  return (size_t)(log(N) / log(1 / p));
+  level = (size_t)(log(N) / log(1 / p));
+  return level < JRSL_MAX_LEVEL ? level : JRSL_MAX_LEVEL;
 }
 
 /* Centers a string by padding it left and right with spaces.
@@ -524,6 +5676,515 @@ void jrsl_display_list(skip_list_t *skip_list, label_printer_t label_printer) {
   }
 }
 
+
+#ifdef JRSL_STATS
+/* Copies the counters of the skip list to `stats` and counts its nodes by
+ * level. Only the levels above the first are walked, which takes
+ * O(n p / (1 - p)). Writers must be kept out. */
+void jrsl_stats_snapshot(skip_list_t *skip_list, jrsl_stats_t *stats) {
+  size_t i;
+
+  *stats = skip_list->stats;
+  stats->width = skip_list->width;
+  stats->level = skip_list->level;
+  stats->nodes[0] = skip_list->width;
+  for (i = 1; i < JRSL_MAX_LEVEL; ++i) {
+    size_t count = 0;
+    if (i < skip_list->level) {
+      skip_node_t *node = skip_list->head->forward[i].node;
+      for (; node; node = node->forward[i].node)
+        ++count;
+    }
+    stats->nodes[i] = count;
+  }
+  stats->average_path =
+      stats->operations ? (double)stats->hops / stats->operations : 0;
+}
+
+/* Sets the counters of the skip list back to 0. */
+void jrsl_stats_reset(skip_list_t *skip_list) {
+  memset(&skip_list->stats, 0, sizeof(skip_list->stats));
+}
+
+/* Prints a snapshot taken by `jrsl_stats_snapshot`. */
+void jrsl_print_stats(const jrsl_stats_t *stats) {
+  size_t i;
+
+  printf("width %lu, level %u\n", (unsigned long)stats->width,
+         (unsigned)stats->level);
+  printf("comparisons %lu, operations %lu, hops %lu (%.2f per operation)\n",
+         (unsigned long)stats->comparisons, (unsigned long)stats->operations,
+         (unsigned long)stats->hops, stats->average_path);
+  printf("allocations %lu, frees %lu\n", (unsigned long)stats->allocations,
+         (unsigned long)stats->frees);
+  for (i = 0; i < stats->level; ++i)
+    printf("level %lu: %lu nodes\n", (unsigned long)i,
+           (unsigned long)stats->nodes[i]);
+}
+#endif /*JRSL_STATS*/
+
+#ifdef JRSL_CONCURRENT
+
+/* Number of nodes a thread retires between two attempts to advance the epoch */
+#ifndef JRSL_CC_ADVANCE
+#define JRSL_CC_ADVANCE 64
+#endif
+
+#define JRSL_CC_MARKED(p) ((size_t)(p) & (size_t)1)
+#define JRSL_CC_MARK(p) ((jrsl_cc_node_t *)((size_t)(p) | (size_t)1))
+#define JRSL_CC_PTR(p) ((jrsl_cc_node_t *)((size_t)(p) & ~(size_t)1))
+#define JRSL_CC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+
+/* The data of a removed node, which can't be updated anymore */
+static char jrsl_cc_dead;
+#define JRSL_CC_DEAD ((void *)&jrsl_cc_dead)
+
+static int jrsl_cc_cas(jrsl_cc_node_t **link, jrsl_cc_node_t *expected,
+                       jrsl_cc_node_t *desired) {
+  return __atomic_compare_exchange_n(link, &expected, desired, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static jrsl_cc_node_t *jrsl_cc_alloc_node(unsigned short level) {
+  jrsl_cc_node_t *node = (jrsl_cc_node_t *)malloc(JRSL_CC_NODE_SIZE(level));
+  if (!node) {
+    /* Allocation failure */
+    exit(EXIT_FAILURE);
+  }
+  node->level = level;
+  node->refs = 2;
+  node->retired = NULL;
+  return node;
+}
+
+/* Frees a chain of retired nodes. */
+static void jrsl_cc_free_retired(jrsl_cc_list_t *list, jrsl_cc_node_t *node) {
+  while (node) {
+    jrsl_cc_node_t *next = node->retired;
+    if (list->key_destructor)
+      list->key_destructor(node->key);
+    free(node);
+    node = next;
+  }
+}
+
+/* Frees the nodes of unregistered threads retired two epochs before `epoch`
+ * or earlier. The caller holds the lock of the list. */
+static void jrsl_cc_free_orphans(jrsl_cc_list_t *list, unsigned long epoch) {
+  unsigned short i;
+
+  for (i = 0; i < 3; ++i) {
+    if (list->orphans[i] && epoch - list->orphan_epoch[i] >= 2) {
+      jrsl_cc_free_retired(list, list->orphans[i]);
+      list->orphans[i] = NULL;
+    }
+  }
+}
+
+/* Tries to move the global epoch forward, which is only possible once every
+ * thread inside an operation has seen the current one. */
+static void jrsl_cc_advance(jrsl_cc_list_t *list) {
+  unsigned long epoch = __atomic_load_n(&list->epoch, __ATOMIC_SEQ_CST);
+  jrsl_cc_thread_t *thread;
+
+  /* Another thread is already walking the records, or unlinking one */
+  if (__atomic_exchange_n(&list->lock, 1, __ATOMIC_ACQUIRE))
+    return;
+
+  thread = __atomic_load_n(&list->threads, __ATOMIC_ACQUIRE);
+  for (; thread; thread = thread->next) {
+    unsigned long state = __atomic_load_n(&thread->state, __ATOMIC_SEQ_CST);
+    if ((state & 1) && state != ((epoch << 1) | 1))
+      break;
+  }
+  if (!thread)
+    __atomic_compare_exchange_n(&list->epoch, &epoch, epoch + 1, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+  jrsl_cc_free_orphans(list, __atomic_load_n(&list->epoch, __ATOMIC_SEQ_CST));
+  __atomic_store_n(&list->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Enters an operation. The nodes retired two epochs ago or more can't be
+ * reached by any thread anymore and are freed. */
+static void jrsl_cc_enter(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread) {
+  unsigned long epoch = __atomic_load_n(&list->epoch, __ATOMIC_SEQ_CST);
+  unsigned short i;
+
+  __atomic_store_n(&thread->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+
+  for (i = 0; i < 3; ++i) {
+    if (thread->retired[i] && epoch - thread->retired_epoch[i] >= 2) {
+      jrsl_cc_free_retired(list, thread->retired[i]);
+      thread->retired[i] = NULL;
+    }
+  }
+}
+
+static void jrsl_cc_exit(jrsl_cc_thread_t *thread) {
+  __atomic_store_n(&thread->state, 0, __ATOMIC_RELEASE);
+}
+
+/* Drops a reference to a node which has been unlinked. The node is freed two
+ * epochs after the last reference is gone. */
+static void jrsl_cc_release(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread,
+                            jrsl_cc_node_t *node) {
+  unsigned long epoch;
+  unsigned short slot;
+
+  if (__atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+
+  /* The epoch must be read after the node was unlinked */
+  epoch = __atomic_load_n(&list->epoch, __ATOMIC_SEQ_CST);
+  slot = (unsigned short)(epoch % 3);
+
+  /* Older nodes in the same slot are at least 3 epochs old */
+  if (thread->retired[slot] && thread->retired_epoch[slot] != epoch) {
+    jrsl_cc_free_retired(list, thread->retired[slot]);
+    thread->retired[slot] = NULL;
+  }
+  node->retired = thread->retired[slot];
+  thread->retired[slot] = node;
+  thread->retired_epoch[slot] = epoch;
+
+  if (++thread->retired_count % JRSL_CC_ADVANCE == 0)
+    jrsl_cc_advance(list);
+}
+
+/* Marks every link of a node, after which it can't be linked to anymore. */
+static void jrsl_cc_mark(jrsl_cc_node_t *node) {
+  unsigned short i;
+  for (i = node->level; i > 0; --i) {
+    jrsl_cc_node_t *succ = JRSL_CC_LOAD(&node->forward[i - 1]);
+    while (!JRSL_CC_MARKED(succ) &&
+           !__atomic_compare_exchange_n(&node->forward[i - 1], &succ,
+                                        JRSL_CC_MARK(succ), 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+      ;
+  }
+}
+
+/* Fills `preds` and `succs` with the last node before `key` and the one after
+ * it on every level, unlinking the marked nodes met on the way. Returns
+ * whether `succs[0]` holds `key`. */
+static int jrsl_cc_find(jrsl_cc_list_t *list, void *key,
+                        jrsl_cc_node_t **preds, jrsl_cc_node_t **succs) {
+  unsigned short i;
+  jrsl_cc_node_t *pred, *curr, *succ;
+  char cmp = 1;
+
+retry:
+  pred = list->head;
+  for (i = list->max_level; i > 0; --i) {
+    curr = JRSL_CC_PTR(JRSL_CC_LOAD(&pred->forward[i - 1]));
+    while (curr) {
+      succ = JRSL_CC_LOAD(&curr->forward[i - 1]);
+      while (JRSL_CC_MARKED(succ)) {
+        /* Fails when `pred` is being removed too or has a new successor */
+        if (!jrsl_cc_cas(&pred->forward[i - 1], curr, JRSL_CC_PTR(succ)))
+          goto retry;
+        curr = JRSL_CC_PTR(succ);
+        if (!curr)
+          break;
+        succ = JRSL_CC_LOAD(&curr->forward[i - 1]);
+      }
+      if (!curr)
+        break;
+
+      cmp = list->comparator(curr->key, key);
+      if (cmp >= 0)
+        break;
+      pred = curr;
+      curr = succ;
+    }
+    preds[i - 1] = pred;
+    succs[i - 1] = curr;
+  }
+  return succs[0] != NULL && cmp == 0;
+}
+
+/* Initializes a concurrent skip list, see `jrsl_initialize`. */
+void jrsl_cc_initialize(jrsl_cc_list_t *list, comparator_t comparator,
+                        key_destructor_t key_destructor, float p,
+                        unsigned short max_level) {
+  unsigned short i;
+
+  assert(max_level <= JRSL_MAX_LEVEL);
+
+  list->max_level = max_level;
+  list->p = p;
+  list->level = 1;
+  list->comparator = comparator;
+  list->key_destructor = key_destructor;
+  list->epoch = 0;
+  list->threads = NULL;
+  list->thread_count = 0;
+  list->lock = 0;
+  for (i = 0; i < 3; ++i)
+    list->orphans[i] = NULL;
+
+  list->head = jrsl_cc_alloc_node(max_level);
+  list->head->key = NULL;
+  list->head->data = NULL;
+  for (i = 0; i < max_level; ++i)
+    list->head->forward[i] = NULL;
+}
+
+/* Frees a concurrent skip list, calling `node_visitor` (if not NULL) on every
+ * node left. No other thread may use the list anymore. */
+void jrsl_cc_destroy(jrsl_cc_list_t *list, node_visitor_t node_visitor) {
+  jrsl_cc_node_t *node = JRSL_CC_PTR(list->head->forward[0]);
+  jrsl_cc_thread_t *thread;
+  unsigned short i;
+
+  while (node) {
+    jrsl_cc_node_t *next = JRSL_CC_PTR(node->forward[0]);
+    if (node_visitor)
+      node_visitor(node->key, node->data);
+    free(node);
+    node = next;
+  }
+  free(list->head);
+  list->head = NULL;
+
+  for (thread = list->threads; thread; thread = thread->next) {
+    for (i = 0; i < 3; ++i) {
+      jrsl_cc_free_retired(list, thread->retired[i]);
+      thread->retired[i] = NULL;
+    }
+  }
+  list->threads = NULL;
+  for (i = 0; i < 3; ++i) {
+    jrsl_cc_free_retired(list, list->orphans[i]);
+    list->orphans[i] = NULL;
+  }
+}
+
+/* Registers the record of a thread, which must be done once by every thread
+ * before using the list. */
+void jrsl_cc_register(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread) {
+  unsigned short i;
+  unsigned long id =
+      __atomic_fetch_add(&list->thread_count, 1, __ATOMIC_RELAXED);
+
+  thread->state = 0;
+  for (i = 0; i < 3; ++i) {
+    thread->retired[i] = NULL;
+    thread->retired_epoch[i] = 0;
+  }
+  thread->retired_count = 0;
+  /* Every thread draws different levels */
+  jrsl_rng_init(&thread->rng, list->p, 2463534242UL + id * 0x9E3779B9UL);
+
+  thread->next = __atomic_load_n(&list->threads, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&list->threads, &thread->next, thread, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+/* Unregisters the record of a thread, which can be freed afterwards. The
+ * thread must not be inside an operation. The nodes it retired are kept by the
+ * list until no thread can hold them anymore. */
+void jrsl_cc_unregister(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread) {
+  jrsl_cc_thread_t *first = thread;
+  unsigned long epoch;
+  unsigned short i;
+
+  /* Waits for `jrsl_cc_advance` to be done with the records */
+  while (__atomic_exchange_n(&list->lock, 1, __ATOMIC_ACQUIRE))
+    ;
+
+  /* Registrations only push records in front, so unless it's still the first
+   * one the record is after `first` */
+  if (!__atomic_compare_exchange_n(&list->threads, &first, thread->next, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    while (first->next != thread)
+      first = first->next;
+    first->next = thread->next;
+  }
+
+  /* Older orphans of a slot go first, the retired nodes of `thread` can then
+   * join the ones left, which are of the same epoch */
+  epoch = __atomic_load_n(&list->epoch, __ATOMIC_SEQ_CST);
+  jrsl_cc_free_orphans(list, epoch);
+  for (i = 0; i < 3; ++i) {
+    jrsl_cc_node_t *chain = thread->retired[i], *last = chain;
+    thread->retired[i] = NULL;
+    if (!chain)
+      continue;
+    if (epoch - thread->retired_epoch[i] >= 2) {
+      jrsl_cc_free_retired(list, chain);
+      continue;
+    }
+    while (last->retired)
+      last = last->retired;
+    last->retired = list->orphans[i];
+    list->orphans[i] = chain;
+    list->orphan_epoch[i] = thread->retired_epoch[i];
+  }
+  __atomic_store_n(&list->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Returns the data of `key` or NULL. The search never waits on other threads
+ * and doesn't write to the list, it simply steps over the nodes being
+ * removed. */
+void *jrsl_cc_search(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread,
+                     void *key) {
+  unsigned short i;
+  jrsl_cc_node_t *pred, *curr = NULL, *succ;
+  void *data = NULL;
+  char cmp = 1;
+
+  jrsl_cc_enter(list, thread);
+
+  pred = list->head;
+  for (i = __atomic_load_n(&list->level, __ATOMIC_ACQUIRE); i > 0; --i) {
+    curr = JRSL_CC_PTR(JRSL_CC_LOAD(&pred->forward[i - 1]));
+    while (curr) {
+      succ = JRSL_CC_LOAD(&curr->forward[i - 1]);
+      if (JRSL_CC_MARKED(succ)) {
+        curr = JRSL_CC_PTR(succ);
+        continue;
+      }
+      cmp = list->comparator(curr->key, key);
+      if (cmp >= 0)
+        break;
+      pred = curr;
+      curr = succ;
+    }
+  }
+
+  if (curr && cmp == 0) {
+    data = __atomic_load_n(&curr->data, __ATOMIC_ACQUIRE);
+    if (data == JRSL_CC_DEAD)
+      data = NULL;
+  }
+
+  jrsl_cc_exit(thread);
+  return data;
+}
+
+/* Inserts or updates `key`, returning the previous data if the key was already
+ * present, see `jrsl_insert`. */
+void *jrsl_cc_insert(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread, void *key,
+                     void *data) {
+  jrsl_cc_node_t *preds[JRSL_MAX_LEVEL];
+  jrsl_cc_node_t *succs[JRSL_MAX_LEVEL];
+  jrsl_cc_node_t *node = NULL;
+  jrsl_cc_node_t *succ;
+  unsigned short i, level, top;
+
+  jrsl_cc_enter(list, thread);
+
+  top = jrsl_draw_level(&thread->rng, list->max_level);
+
+  for (;;) {
+    if (jrsl_cc_find(list, key, preds, succs)) {
+      /* Updates the existing node, unless it's being removed */
+      jrsl_cc_node_t *found = succs[0];
+      void *old = __atomic_load_n(&found->data, __ATOMIC_ACQUIRE);
+      while (old != JRSL_CC_DEAD) {
+        if (__atomic_compare_exchange_n(&found->data, &old, data, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+          /* `node` was never visible to other threads */
+          free(node);
+          jrsl_cc_exit(thread);
+          return old;
+        }
+      }
+      /* Helps removing it before trying again */
+      jrsl_cc_mark(found);
+      continue;
+    }
+
+    if (!node) {
+      node = jrsl_cc_alloc_node(top);
+      node->key = key;
+      node->data = data;
+    }
+    for (i = 0; i < top; ++i)
+      node->forward[i] = succs[i];
+
+    /* The node is in the list once linked on the lowest level */
+    if (jrsl_cc_cas(&preds[0]->forward[0], succs[0], node))
+      break;
+  }
+
+  level = __atomic_load_n(&list->level, __ATOMIC_RELAXED);
+  while (level < top &&
+         !__atomic_compare_exchange_n(&list->level, &level, top, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+
+  /* Links the upper levels, unless the node gets removed meanwhile */
+  for (i = 1; i < top; ++i) {
+    for (;;) {
+      succ = JRSL_CC_LOAD(&node->forward[i]);
+      if (JRSL_CC_MARKED(succ))
+        goto linked;
+      /* Only fails when the link gets marked */
+      if (succ != succs[i] && !jrsl_cc_cas(&node->forward[i], succ, succs[i]))
+        goto linked;
+      if (jrsl_cc_cas(&preds[i]->forward[i], succs[i], node))
+        break;
+      if (!jrsl_cc_find(list, key, preds, succs) || succs[0] != node)
+        goto linked;
+    }
+  }
+
+linked:
+  /* A concurrent remove may have been done before the last link, in which
+   * case the node must be unlinked again. */
+  if (__atomic_load_n(&node->data, __ATOMIC_ACQUIRE) == JRSL_CC_DEAD)
+    jrsl_cc_find(list, key, preds, succs);
+  jrsl_cc_release(list, thread, node);
+
+  jrsl_cc_exit(thread);
+  return NULL;
+}
+
+/* Removes `key` and returns its data, or NULL if it wasn't in the list. The
+ * node is freed later, once no other thread can reach it. */
+void *jrsl_cc_remove(jrsl_cc_list_t *list, jrsl_cc_thread_t *thread,
+                     void *key) {
+  jrsl_cc_node_t *preds[JRSL_MAX_LEVEL];
+  jrsl_cc_node_t *succs[JRSL_MAX_LEVEL];
+  jrsl_cc_node_t *node;
+  void *data;
+
+  jrsl_cc_enter(list, thread);
+
+  for (;;) {
+    if (!jrsl_cc_find(list, key, preds, succs)) {
+      jrsl_cc_exit(thread);
+      return NULL;
+    }
+
+    /* The remove takes effect when the data is swapped for the sentinel */
+    node = succs[0];
+    data = __atomic_load_n(&node->data, __ATOMIC_ACQUIRE);
+    while (data != JRSL_CC_DEAD) {
+      if (__atomic_compare_exchange_n(&node->data, &data, JRSL_CC_DEAD, 0,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        goto removed;
+    }
+    /* Another thread is removing it, helps and tries again */
+    jrsl_cc_mark(node);
+  }
+
+removed:
+  /* Unlinks the node from every level */
+  jrsl_cc_mark(node);
+  jrsl_cc_find(list, key, preds, succs);
+  jrsl_cc_release(list, thread, node);
+
+  jrsl_cc_exit(thread);
+  return data;
+}
+
+#endif /*JRSL_CONCURRENT*/
+
 #endif /*JRSL_IMPLEMENTATION*/
 
 /* ============================================================================